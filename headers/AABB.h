@@ -11,7 +11,7 @@ private:
 
 public:
     AABB() {}
-    AABB(const Point3 &a, const Point3 &b) : maximum(a), minimum(b) {}
+    AABB(const Point3 &a, const Point3 &b) : maximum(b), minimum(a) {}
 
     Point3 min() const { return minimum; }
     Point3 max() const { return maximum; }
@@ -20,10 +20,10 @@ public:
     {
         for (size_t i = 0; i < 3; i++)
         {
-            double t0 = fmin((minimum[i] - ray.origin()[i]) / ray.direction()[i],
-                             (maximum[i] - ray.origin()[i]) / ray.direction()[i]);
-            double t1 = fmax((minimum[i] - ray.origin()[i]) / ray.direction()[i],
-                             (maximum[i] - ray.origin()[i]) / ray.direction()[i]);
+            real t0 = fmin((minimum[i] - ray.origin()[i]) / ray.direction()[i],
+                           (maximum[i] - ray.origin()[i]) / ray.direction()[i]);
+            real t1 = fmax((minimum[i] - ray.origin()[i]) / ray.direction()[i],
+                           (maximum[i] - ray.origin()[i]) / ray.direction()[i]);
 
             t_min = fmax(t0, t_min);
             t_max = fmin(t1, t_max);
@@ -37,9 +37,9 @@ public:
     {
         for (size_t i = 0; i < 3; i++)
         {
-            double invdir = 1.0 / ray.direction()[i];
-            double t0 = (minimum[i] - ray.origin()[i]) * invdir;
-            double t1 = (maximum[i] - ray.origin()[i]) * invdir;
+            real invdir = 1.0 / ray.direction()[i];
+            real t0 = (minimum[i] - ray.origin()[i]) * invdir;
+            real t1 = (maximum[i] - ray.origin()[i]) * invdir;
 
             if (invdir < 0.0f)
                 std::swap(t0, t1);
@@ -56,13 +56,5 @@ public:
 
 inline AABB surroundingBox(AABB box0, AABB box1)
 {
-    Point3 small(fmin(box0.min().x(), box1.min().x()),
-                 fmin(box0.min().y(), box1.min().y()),
-                 fmin(box0.min().z(), box1.min().z()));
-
-    Point3 big(fmax(box0.max().x(), box1.max().x()),
-               fmax(box0.max().y(), box1.max().y()),
-               fmax(box0.max().z(), box1.max().z()));
-
-    return AABB(small, big);
+    return AABB(component_min(box0.min(), box1.min()), component_max(box0.max(), box1.max()));
 }
\ No newline at end of file
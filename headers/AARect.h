@@ -7,68 +7,207 @@
 
 #include "Hittable.h"
 
+// Orientation-independent description of an axis-aligned rectangle: the
+// plane axis = k, bounded by [a0, a1] x [b0, b1] along the other two axes
+// in increasing order.
+struct RectBounds
+{
+    int axis;
+    real k;
+    real a0, a1, b0, b1;
+
+    // The two in-plane axes for a plane axis, in the order used above
+    static int axisA(int axis) { return axis == 0 ? 1 : 0; }
+    static int axisB(int axis) { return axis == 2 ? 1 : 2; }
+};
+
+// Light sampling shared by the rect types: points are drawn uniformly over
+// the area, so the solid angle density is distance^2 / (cosine * area).
+inline double rectPdfValue(const Hittable &rect, const RectBounds &b, const Point3 &origin, const Vec3 &direction)
+{
+    HitPoint point;
+    if (!rect.intersect(Ray(origin, direction), ray_t_min, infinity, point))
+        return 0.0;
+
+    real area = (b.a1 - b.a0) * (b.b1 - b.b0);
+    real distance_squared = point.t * point.t * direction.length_squared();
+    real cosine = fabs(direction[b.axis]) / direction.length();
+    return distance_squared / (cosine * area);
+}
+
+// Occlusion test shared by the rect types, same arithmetic as their hit()
+inline bool rectOccluded(const RectBounds &b, const Ray &ray, double t_min, double t_max)
+{
+    int a = RectBounds::axisA(b.axis);
+    int c = RectBounds::axisB(b.axis);
+    real t = (b.k - ray.origin()[b.axis]) / ray.direction()[b.axis];
+    if (t < t_min || t > t_max)
+        return false;
+    real pa = ray.origin()[a] + t * ray.direction()[a];
+    real pc = ray.origin()[c] + t * ray.direction()[c];
+    return pa >= b.a0 && pa <= b.a1 && pc >= b.b0 && pc <= b.b1;
+}
+
+inline Vec3 rectRandomDirection(const RectBounds &b, const Point3 &origin)
+{
+    Point3 target;
+    target[b.axis] = b.k;
+    target[RectBounds::axisA(b.axis)] = random_double(b.a0, b.a1);
+    target[RectBounds::axisB(b.axis)] = random_double(b.b0, b.b1);
+    return target - origin;
+}
+
 class XYRect : public Hittable
 {
 private:
     shared_ptr<Material> mp;
-    double x0, x1, y0, y1, k;
+    real x0, x1, y0, y1, k;
 
 public:
     XYRect();
-    XYRect(double _x0, double _x1, double _y0, double _y1, double _k, shared_ptr<Material> mat)
+    XYRect(real _x0, real _x1, real _y0, real _y1, real _k, shared_ptr<Material> mat)
         : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {}
 
-    virtual bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const override;
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual void fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const override { setRecord(ray, point.t, rec); }
+    virtual int hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const override;
+
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override { return rectOccluded(bounds(), ray, t_min, t_max); }
+    virtual double pdfValue(const Point3 &origin, const Vec3 &direction) const override { return rectPdfValue(*this, bounds(), origin, direction); }
+    virtual Vec3 randomDirection(const Point3 &origin) const override { return rectRandomDirection(bounds(), origin); }
 
     virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override
     {
         OutBox = AABB(Point3(x0, y0, k - 1e-4), Point3(x1, y1, k + 1e-4));
         return true;
     }
+
+    RectBounds bounds() const { return RectBounds{2, k, x0, x1, y0, y1}; }
+    shared_ptr<Material> getMaterial() const { return mp; }
+
+private:
+    void setRecord(const Ray &ray, double t, HitRecord &rec) const
+    {
+        auto x = ray.origin().x() + t * ray.direction().x();
+        auto y = ray.origin().y() + t * ray.direction().y();
+        rec.u = (x - x0) / (x1 - x0);
+        rec.v = (y - y0) / (y1 - y0);
+        rec.t = t;
+        auto outward_normal = Vec3(0, 0, 1);
+        rec.set_face_normal(ray, outward_normal);
+        rec.mat_ptr = mp.get();
+        rec.p = ray.at(t);
+    }
 };
 
 class XZRect : public Hittable
 {
 private:
     shared_ptr<Material> mp;
-    double x0, x1, z0, z1, k;
+    real x0, x1, z0, z1, k;
 
 public:
     XZRect();
-    XZRect(double _x0, double _x1, double _z0, double _z1, double _k, shared_ptr<Material> mat)
+    XZRect(real _x0, real _x1, real _z0, real _z1, real _k, shared_ptr<Material> mat)
         : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {}
 
-    virtual bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const override;
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual void fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const override { setRecord(ray, point.t, rec); }
+    virtual int hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const override;
+
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override { return rectOccluded(bounds(), ray, t_min, t_max); }
+    virtual double pdfValue(const Point3 &origin, const Vec3 &direction) const override { return rectPdfValue(*this, bounds(), origin, direction); }
+    virtual Vec3 randomDirection(const Point3 &origin) const override { return rectRandomDirection(bounds(), origin); }
 
     virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override
     {
         OutBox = AABB(Point3(x0, k - 1e-4, z0), Point3(x1, k + 1e-4, z1));
         return true;
     }
+
+    RectBounds bounds() const { return RectBounds{1, k, x0, x1, z0, z1}; }
+    shared_ptr<Material> getMaterial() const { return mp; }
+
+private:
+    void setRecord(const Ray &ray, double t, HitRecord &rec) const
+    {
+        auto x = ray.origin().x() + t * ray.direction().x();
+        auto z = ray.origin().z() + t * ray.direction().z();
+        rec.u = (x - x0) / (x1 - x0);
+        rec.v = (z - z0) / (z1 - z0);
+        rec.t = t;
+        auto outward_normal = Vec3(0, 1, 0);
+        rec.set_face_normal(ray, outward_normal);
+        rec.mat_ptr = mp.get();
+        rec.p = ray.at(t);
+    }
 };
 
 class YZRect : public Hittable
 {
 private:
     shared_ptr<Material> mp;
-    double y0, y1, z0, z1, k;
+    real y0, y1, z0, z1, k;
 
 public:
     YZRect();
-    YZRect(double _y0, double _y1, double _z0, double _z1, double _k, shared_ptr<Material> mat)
+    YZRect(real _y0, real _y1, real _z0, real _z1, real _k, shared_ptr<Material> mat)
         : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {}
 
-    virtual bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const override;
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual void fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const override { setRecord(ray, point.t, rec); }
+    virtual int hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const override;
+
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override { return rectOccluded(bounds(), ray, t_min, t_max); }
+    virtual double pdfValue(const Point3 &origin, const Vec3 &direction) const override { return rectPdfValue(*this, bounds(), origin, direction); }
+    virtual Vec3 randomDirection(const Point3 &origin) const override { return rectRandomDirection(bounds(), origin); }
 
     virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override
     {
         OutBox = AABB(Point3(k - 1e-4, y0, z0), Point3(k + 1e-4, y1, z1));
         return true;
     }
+
+    RectBounds bounds() const { return RectBounds{0, k, y0, y1, z0, z1}; }
+    shared_ptr<Material> getMaterial() const { return mp; }
+
+private:
+    void setRecord(const Ray &ray, double t, HitRecord &rec) const
+    {
+        auto y = ray.origin().y() + t * ray.direction().y();
+        auto z = ray.origin().z() + t * ray.direction().z();
+        rec.u = (y - y0) / (y1 - y0);
+        rec.v = (z - z0) / (z1 - z0);
+        rec.t = t;
+        auto outward_normal = Vec3(1, 0, 0);
+        rec.set_face_normal(ray, outward_normal);
+        rec.mat_ptr = mp.get();
+        rec.p = ray.at(t);
+    }
 };
 
+// SIMD rectangle test shared by the three orientations: the plane is
+// axis k = kValue, bounded by [a0, a1] x [b0, b1] along axes a and b.
+// Returns the lanes hit and their distances in tHit. Computed in `real`, like
+// the rects' hit().
+inline int rectPacketHit(const RayPacket &packet, int mask, int k, int a, int b, double kValue,
+                         double a0, double a1, double b0, double b1,
+                         double t_min, const double t_max[], double tHit[])
+{
+    Real4 t = (Real4(kValue) - Real4(packet.o(k))) / Real4(packet.d(k));
+    Double4 valid = (Double4(t_min) <= t) & (t <= Double4::load(t_max));
+    Real4 pa = Real4(packet.o(a)) + t * Real4(packet.d(a));
+    Real4 pb = Real4(packet.o(b)) + t * Real4(packet.d(b));
+    valid = valid & (Double4(a0) <= pa) & (pa <= Double4(a1)) & (Double4(b0) <= pb) & (pb <= Double4(b1));
+
+    int hitMask = valid.bits() & mask;
+    if (hitMask)
+        t.store(tHit);
+    return hitMask;
+}
+
 // Functions
-bool XYRect::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+bool XYRect::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
 {
     auto t = (k - ray.origin().z()) / ray.direction().z();
     if (t < t_min || t > t_max)
@@ -77,17 +216,12 @@ bool XYRect::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) con
     auto y = ray.origin().y() + t * ray.direction().y();
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
-    rec.t = t;
-    auto outward_normal = Vec3(0, 0, 1);
-    rec.set_face_normal(ray, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = ray.at(t);
+    point.t = t;
+    point.object = this;
     return true;
 }
 
-bool XZRect::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+bool XZRect::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
 {
     auto t = (k - ray.origin().y()) / ray.direction().y();
     if (t < t_min || t > t_max)
@@ -96,17 +230,12 @@ bool XZRect::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) con
     auto z = ray.origin().z() + t * ray.direction().z();
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (z - z0) / (z1 - z0);
-    rec.t = t;
-    auto outward_normal = Vec3(0, 1, 0);
-    rec.set_face_normal(ray, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = ray.at(t);
+    point.t = t;
+    point.object = this;
     return true;
 }
 
-bool YZRect::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+bool YZRect::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
 {
     auto t = (k - ray.origin().x()) / ray.direction().x();
     if (t < t_min || t > t_max)
@@ -115,12 +244,52 @@ bool YZRect::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) con
     auto z = ray.origin().z() + t * ray.direction().z();
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
-    rec.u = (y - y0) / (y1 - y0);
-    rec.v = (z - z0) / (z1 - z0);
-    rec.t = t;
-    auto outward_normal = Vec3(1, 0, 0);
-    rec.set_face_normal(ray, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = ray.at(t);
+    point.t = t;
+    point.object = this;
     return true;
 }
+
+int XYRect::hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const
+{
+    alignas(32) double tHit[RayPacket::size];
+    int hitMask = rectPacketHit(packet, mask, 2, 0, 1, k, x0, x1, y0, y1, t_min, t_max, tHit);
+    for (int lane = 0; lane < RayPacket::size; lane++)
+    {
+        if (hitMask >> lane & 1)
+        {
+            setRecord(packet.rays[lane], tHit[lane], recs[lane]);
+            t_max[lane] = tHit[lane];
+        }
+    }
+    return hitMask;
+}
+
+int XZRect::hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const
+{
+    alignas(32) double tHit[RayPacket::size];
+    int hitMask = rectPacketHit(packet, mask, 1, 0, 2, k, x0, x1, z0, z1, t_min, t_max, tHit);
+    for (int lane = 0; lane < RayPacket::size; lane++)
+    {
+        if (hitMask >> lane & 1)
+        {
+            setRecord(packet.rays[lane], tHit[lane], recs[lane]);
+            t_max[lane] = tHit[lane];
+        }
+    }
+    return hitMask;
+}
+
+int YZRect::hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const
+{
+    alignas(32) double tHit[RayPacket::size];
+    int hitMask = rectPacketHit(packet, mask, 0, 1, 2, k, y0, y1, z0, z1, t_min, t_max, tHit);
+    for (int lane = 0; lane < RayPacket::size; lane++)
+    {
+        if (hitMask >> lane & 1)
+        {
+            setRecord(packet.rays[lane], tHit[lane], recs[lane]);
+            t_max[lane] = tHit[lane];
+        }
+    }
+    return hitMask;
+}
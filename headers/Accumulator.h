@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "Commons.h"
+#include "Vec3.h"
+
+// Running per-pixel radiance sums and sample counts. Progressive renders add
+// samples pass by pass and can checkpoint the buffer to disk to resume later.
+// The mean and variance of each pixel's luminance are tracked with Welford's
+// algorithm so adaptive sampling can tell when a pixel has converged.
+class Accumulator
+{
+public:
+    // Radiance summed in double whatever `real` is, so long renders in the
+    // float build keep the precision of their many small contributions
+    struct Sum
+    {
+        double r = 0, g = 0, b = 0;
+    };
+
+    int width = 0;
+    int height = 0;
+    std::vector<Sum> sum;
+    std::vector<uint32_t> samples;
+    std::vector<double> lumMean;
+    std::vector<double> lumM2; // Sum of squared deviations from lumMean
+    std::vector<uint8_t> converged; // Pixels adaptive sampling has stopped
+
+public:
+    Accumulator() {}
+    Accumulator(int w, int h)
+        : width(w), height(h), sum(static_cast<size_t>(w) * h), samples(static_cast<size_t>(w) * h, 0),
+          lumMean(sum.size(), 0.0), lumM2(sum.size(), 0.0), converged(sum.size(), 0) {}
+
+    size_t size() const { return sum.size(); }
+
+    void add(size_t index, const Color &radiance)
+    {
+        sum[index].r += radiance.x();
+        sum[index].g += radiance.y();
+        sum[index].b += radiance.z();
+        uint32_t n = ++samples[index];
+
+        double lum = luminance(radiance);
+        double delta = lum - lumMean[index];
+        lumMean[index] += delta / n;
+        lumM2[index] += delta * (lum - lumMean[index]);
+    }
+
+    // Standard error of the pixel's mean luminance, pooled over its 3x3
+    // neighbourhood and scaled by the square root of the mean to match the
+    // gamma 2 output. Pooling steadies estimates from few heavy-tailed
+    // samples, which would otherwise stop pixels that merely got lucky.
+    double relativeError(size_t index) const
+    {
+        int x = static_cast<int>(index % width);
+        int y = static_cast<int>(index / width);
+        double errorSum = 0, meanSum = 0;
+        int pixels = 0;
+        for (int j = std::max(0, y - 1); j <= std::min(height - 1, y + 1); j++)
+        {
+            for (int i = std::max(0, x - 1); i <= std::min(width - 1, x + 1); i++)
+            {
+                size_t k = static_cast<size_t>(j) * width + i;
+                uint32_t n = samples[k];
+                if (n < 2)
+                    return infinity;
+                errorSum += lumM2[k] / (n - 1) / n;
+                meanSum += lumMean[k];
+                pixels++;
+            }
+        }
+        return std::sqrt(errorSum / pixels) / std::sqrt(std::max(meanSum / pixels, 0.01));
+    }
+
+    // Stops pixels with at least minSamples samples whose error is below
+    // threshold; returns how many pixels are still being sampled.
+    size_t updateConvergence(double threshold, uint32_t minSamples)
+    {
+        std::vector<uint8_t> next = converged;
+        size_t active = 0;
+        for (size_t i = 0; i < size(); i++)
+        {
+            if (!next[i] && samples[i] >= minSamples && relativeError(i) < threshold)
+                next[i] = 1;
+            active += !next[i];
+        }
+        converged.swap(next);
+        return active;
+    }
+
+    uint32_t minSamples() const
+    {
+        uint32_t result = UINT32_MAX;
+        for (uint32_t count : samples)
+            result = count < result ? count : result;
+        return samples.empty() ? 0 : result;
+    }
+
+    uint64_t totalSamples() const
+    {
+        uint64_t total = 0;
+        for (uint32_t count : samples)
+            total += count;
+        return total;
+    }
+
+    // Samples needed to bring every pixel still being sampled up to target
+    uint64_t samplesToReach(uint32_t target) const
+    {
+        uint64_t total = 0;
+        for (size_t i = 0; i < size(); i++)
+            if (!converged[i] && samples[i] < target)
+                total += target - samples[i];
+        return total;
+    }
+
+    // Per-pixel mean radiance, ready to be written with one sample per pixel.
+    std::vector<Color> resolve() const
+    {
+        std::vector<Color> mean(sum.size());
+        for (size_t i = 0; i < sum.size(); i++)
+        {
+            if (!samples[i])
+                continue;
+            double scale = 1.0 / samples[i];
+            mean[i] = Color(scale * sum[i].r, scale * sum[i].g, scale * sum[i].b);
+        }
+        return mean;
+    }
+
+    // Checkpoint layout: header, then the sums as doubles, the counts as
+    // uint32, the luminance statistics as doubles and the converged flags as
+    // bytes, in pixel order. Written to a temporary file and renamed so an
+    // interrupted write never replaces a good checkpoint.
+    bool save(const std::string &fileName, uint64_t seed) const
+    {
+        std::string temporary = fileName + ".tmp";
+        std::FILE *file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return false;
+
+        Header header{};
+        std::memcpy(header.magic, "RTCKPT", sizeof(header.magic));
+        header.version = version;
+        header.width = width;
+        header.height = height;
+        header.seed = seed;
+
+        std::vector<double> values(3 * sum.size());
+        for (size_t i = 0; i < sum.size(); i++)
+        {
+            values[3 * i] = sum[i].r;
+            values[3 * i + 1] = sum[i].g;
+            values[3 * i + 2] = sum[i].b;
+        }
+
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  std::fwrite(values.data(), sizeof(double), values.size(), file) == values.size() &&
+                  std::fwrite(samples.data(), sizeof(uint32_t), samples.size(), file) == samples.size() &&
+                  std::fwrite(lumMean.data(), sizeof(double), lumMean.size(), file) == lumMean.size() &&
+                  std::fwrite(lumM2.data(), sizeof(double), lumM2.size(), file) == lumM2.size() &&
+                  std::fwrite(converged.data(), 1, converged.size(), file) == converged.size();
+        ok = std::fclose(file) == 0 && ok;
+
+        return ok && std::rename(temporary.c_str(), fileName.c_str()) == 0;
+    }
+
+    // Replaces the buffer with a checkpoint; fails on a malformed file. The
+    // file size must match the header's resolution before anything is
+    // allocated, so a corrupt header cannot ask for an enormous buffer.
+    bool load(const std::string &fileName, uint64_t &seed)
+    {
+        std::error_code error;
+        uint64_t fileBytes = std::filesystem::file_size(fileName, error);
+        if (error)
+            return false;
+        std::FILE *file = std::fopen(fileName.c_str(), "rb");
+        if (!file)
+            return false;
+
+        Header header;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                  std::memcmp(header.magic, "RTCKPT", sizeof(header.magic)) == 0 &&
+                  header.version == version && header.width > 0 && header.height > 0;
+        if (ok)
+        {
+            uint64_t pixels = static_cast<uint64_t>(header.width) * static_cast<uint64_t>(header.height);
+            uint64_t payload = fileBytes - sizeof(header);
+            ok = pixels <= payload / bytesPerPixel && pixels * bytesPerPixel == payload;
+        }
+
+        if (ok)
+        {
+            *this = Accumulator(header.width, header.height);
+            seed = header.seed;
+
+            std::vector<double> values(3 * sum.size());
+            ok = std::fread(values.data(), sizeof(double), values.size(), file) == values.size() &&
+                 std::fread(samples.data(), sizeof(uint32_t), samples.size(), file) == samples.size() &&
+                 std::fread(lumMean.data(), sizeof(double), lumMean.size(), file) == lumMean.size() &&
+                 std::fread(lumM2.data(), sizeof(double), lumM2.size(), file) == lumM2.size() &&
+                 std::fread(converged.data(), 1, converged.size(), file) == converged.size();
+            for (size_t i = 0; ok && i < sum.size(); i++)
+                sum[i] = Sum{values[3 * i], values[3 * i + 1], values[3 * i + 2]};
+        }
+
+        std::fclose(file);
+        return ok;
+    }
+
+private:
+    static double luminance(const Color &c) { return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z(); }
+
+    static const uint32_t version = 2;
+    // Sums, count, luminance mean and M2, converged flag
+    static const uint64_t bytesPerPixel = 3 * sizeof(double) + sizeof(uint32_t) + 2 * sizeof(double) + 1;
+
+    struct Header
+    {
+        char magic[6];
+        uint16_t pad;
+        uint32_t version;
+        int32_t width;
+        int32_t height;
+        uint64_t seed;
+    };
+};
@@ -0,0 +1,711 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "Commons.h"
+#include "Vec3.h"
+#include "Ray.h"
+#include "AABB.h"
+
+#include "Hittable.h"
+#include "HittableList.h"
+#include "Profiler.h"
+
+// One node of a flattened, depth-first BVH. Interior nodes store their first
+// child directly after themselves and the second child at `offset`; leaves
+// store the range [offset, offset + count) of the primitive index array.
+// Bounds are kept in float, rounded outwards, to fit the node in 32 bytes.
+struct BVHNode
+{
+    float bmin[3];
+    float bmax[3];
+    uint32_t offset;
+    uint16_t count; // 0 for interior nodes
+    uint16_t axis;
+
+    bool isLeaf() const { return count != 0; }
+
+    // Branch-free slab test returning the entry distance, or infinity on a miss.
+    double enter(const double origin[3], const double invDir[3], double t_min, double t_max) const
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            double t0 = (bmin[i] - origin[i]) * invDir[i];
+            double t1 = (bmax[i] - origin[i]) * invDir[i];
+            t_min = std::max(t_min, std::min(t0, t1));
+            t_max = std::min(t_max, std::max(t0, t1));
+        }
+        return t_min <= t_max ? t_min : infinity;
+    }
+
+    // Packet slab test, returns the mask of lanes entering the box.
+    int enterPacket(const RayPacket &packet, Double4 t_min, Double4 t_max) const
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            Double4 t0 = (Double4(bmin[i]) - packet.o(i)) * packet.invD(i);
+            Double4 t1 = (Double4(bmax[i]) - packet.o(i)) * packet.invD(i);
+            t_min = max(t_min, min(t0, t1));
+            t_max = min(t_max, max(t0, t1));
+        }
+        return (t_min <= t_max).bits();
+    }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must stay 32 bytes");
+
+// Surface Area Heuristic BVH over an array of primitive bounds. The tree only
+// knows primitive indices; callers supply the leaf intersection routine.
+class BVHTree
+{
+public:
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> primIndices; // Leaf ranges index into this
+
+    static const int bins = 12;
+
+    // Cost of one traversal step relative to one primitive test, and the
+    // largest leaf the builder may create. Cheap primitives favour larger leaves.
+    double traversalCost = 1.0;
+    uint32_t maxLeafSize = 4;
+
+    // Threads a build may use. A subtree of at least parallelSubtree
+    // primitives goes to an idle thread, and a node of at least parallelNode
+    // primitives is bounded and binned by several. The tree comes out the
+    // same for any thread count.
+    inline static int buildThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    static const size_t parallelSubtree = 16384;
+    static const size_t parallelNode = 262144;
+
+    // Deepest level a node may sit at, counting the root as level 0 and
+    // bounded by the builder. The traversal stacks are sized from it.
+    static const int maxDepth = 64;
+
+public:
+    BVHTree() {}
+    BVHTree(const std::vector<AABB> &bounds) { build(bounds); }
+
+    void build(const std::vector<AABB> &bounds)
+    {
+        nodes.clear();
+        primIndices.resize(bounds.size());
+        centroids.resize(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++)
+        {
+            primIndices[i] = static_cast<uint32_t>(i);
+            centroids[i] = 0.5 * (bounds[i].min() + bounds[i].max());
+        }
+
+        if (!bounds.empty())
+        {
+            BuildContext context(bounds, buildThreads);
+            nodes.reserve(2 * bounds.size() / maxLeafSize + 1);
+            nodes.emplace_back();
+            buildRecursive(context, nodes, 0, 0, bounds.size(), 0);
+        }
+
+        centroids.clear();
+        centroids.shrink_to_fit();
+    }
+
+    bool empty() const { return nodes.empty(); }
+
+    AABB bounds() const
+    {
+        const BVHNode &root = nodes[0];
+        return AABB(Point3(root.bmin[0], root.bmin[1], root.bmin[2]),
+                    Point3(root.bmax[0], root.bmax[1], root.bmax[2]));
+    }
+
+    // Walks the tree front to back. leafHit(first, count, t_max) tests the
+    // primitives primIndices[first, first + count), shrinking t_max and
+    // returning true when one of them is hit.
+    template <typename LeafHit>
+    bool traverse(const Ray &ray, double t_min, double t_max, LeafHit &&leafHit) const
+    {
+        return traverse(nodes.data(), nodes.size(), ray, t_min, t_max, leafHit);
+    }
+
+    // Any-hit version of traverse(): returns as soon as leafTest(first, count)
+    // reports a hit in [t_min, t_max]. Nearer children still go first, which
+    // finds a blocker sooner on long segments.
+    template <typename LeafTest>
+    bool traverseAny(const Ray &ray, double t_min, double t_max, LeafTest &&leafTest) const
+    {
+        return traverseAny(nodes.data(), nodes.size(), ray, t_min, t_max, leafTest);
+    }
+
+    // The traversals above over nodes stored elsewhere, such as a mapped file
+    template <typename LeafHit>
+    static bool traverse(const BVHNode *nodes, size_t nodeCount, const Ray &ray, double t_min, double t_max, LeafHit &&leafHit)
+    {
+        if (nodeCount == 0)
+            return false;
+
+        const Point3 o = ray.origin();
+        const Vec3 d = ray.direction();
+        const double origin[3] = {o.x(), o.y(), o.z()};
+        const double invDir[3] = {1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z()};
+
+        if (nodes[0].enter(origin, invDir, t_min, t_max) == infinity)
+            return false;
+
+        // Deferred far children with their entry distance
+        uint32_t stack[maxDepth];
+        double stackT[maxDepth];
+        int stackSize = 0;
+        uint32_t current = 0;
+        bool hitAnything = false;
+
+        while (true)
+        {
+            const BVHNode &node = nodes[current];
+            PROFILE_COUNT(nodesVisited, 1);
+            if (node.isLeaf())
+            {
+                PROFILE_COUNT(primitiveTests, node.count);
+                if (leafHit(node.offset, node.count, t_max))
+                    hitAnything = true;
+            }
+            else
+            {
+                uint32_t first = current + 1;
+                uint32_t second = node.offset;
+                double tFirst = nodes[first].enter(origin, invDir, t_min, t_max);
+                double tSecond = nodes[second].enter(origin, invDir, t_min, t_max);
+                if (tSecond < tFirst)
+                {
+                    std::swap(first, second);
+                    std::swap(tFirst, tSecond);
+                }
+
+                if (tFirst != infinity)
+                {
+                    if (tSecond != infinity)
+                    {
+                        stack[stackSize] = second;
+                        stackT[stackSize++] = tSecond;
+                    }
+                    current = first;
+                    continue;
+                }
+            }
+
+            // Skip far children that lie behind a hit found since they were pushed.
+            do
+            {
+                if (stackSize == 0)
+                    return hitAnything;
+                --stackSize;
+            } while (stackT[stackSize] > t_max);
+            current = stack[stackSize];
+        }
+    }
+
+    template <typename LeafTest>
+    static bool traverseAny(const BVHNode *nodes, size_t nodeCount, const Ray &ray, double t_min, double t_max, LeafTest &&leafTest)
+    {
+        if (nodeCount == 0)
+            return false;
+
+        const Point3 o = ray.origin();
+        const Vec3 d = ray.direction();
+        const double origin[3] = {o.x(), o.y(), o.z()};
+        const double invDir[3] = {1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z()};
+
+        if (nodes[0].enter(origin, invDir, t_min, t_max) == infinity)
+            return false;
+
+        uint32_t stack[maxDepth];
+        int stackSize = 0;
+        uint32_t current = 0;
+
+        while (true)
+        {
+            const BVHNode &node = nodes[current];
+            PROFILE_COUNT(nodesVisited, 1);
+            if (node.isLeaf())
+            {
+                PROFILE_COUNT(primitiveTests, node.count);
+                if (leafTest(node.offset, node.count))
+                    return true;
+            }
+            else
+            {
+                uint32_t first = current + 1;
+                uint32_t second = node.offset;
+                double tFirst = nodes[first].enter(origin, invDir, t_min, t_max);
+                double tSecond = nodes[second].enter(origin, invDir, t_min, t_max);
+                if (tSecond < tFirst)
+                {
+                    std::swap(first, second);
+                    std::swap(tFirst, tSecond);
+                }
+
+                if (tFirst != infinity)
+                {
+                    if (tSecond != infinity)
+                        stack[stackSize++] = second;
+                    current = first;
+                    continue;
+                }
+            }
+
+            if (stackSize == 0)
+                return false;
+            current = stack[--stackSize];
+        }
+    }
+
+    // Packet version of traverse(). Nodes are visited while any lane in `mask`
+    // still enters them; children are ordered by the direction of the first
+    // active lane. leafHit(first, count, activeMask, t_max) returns the lanes hit.
+    template <typename LeafHit>
+    int traversePacket(const RayPacket &packet, int mask, double t_min, double t_max[], LeafHit &&leafHit) const
+    {
+        if (nodes.empty())
+            return 0;
+
+        Double4 tMin(t_min);
+        uint32_t stack[maxDepth];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        int hitMask = 0;
+
+        while (stackSize > 0)
+        {
+            const BVHNode &node = nodes[stack[--stackSize]];
+            PROFILE_COUNT(nodesVisited, 1);
+            int active = node.enterPacket(packet, tMin, Double4::load(t_max)) & mask;
+            if (!active)
+                continue;
+
+            if (node.isLeaf())
+            {
+                PROFILE_COUNT(primitiveTests, node.count);
+                hitMask |= leafHit(node.offset, node.count, active, t_max);
+                continue;
+            }
+
+            uint32_t first = static_cast<uint32_t>(&node - nodes.data()) + 1;
+            uint32_t second = node.offset;
+            int lane = __builtin_ctz(active);
+            if (packet.direction[node.axis][lane] < 0)
+                std::swap(first, second);
+
+            stack[stackSize++] = second;
+            stack[stackSize++] = first;
+        }
+
+        return hitMask;
+    }
+
+private:
+    std::vector<Point3> centroids;
+
+    struct Bin
+    {
+        AABB box = emptyBox();
+        uint32_t count = 0;
+    };
+
+    // Bounds of a range of primitives and of their centroids
+    struct Extent
+    {
+        AABB box = emptyBox();
+        AABB centroidBox = emptyBox();
+
+        void merge(const Extent &other)
+        {
+            box = grow(box, other.box);
+            centroidBox = grow(centroidBox, other.centroidBox);
+        }
+    };
+
+    // Centroid bins of a range of primitives along each axis
+    struct BinGrid
+    {
+        Bin cells[3][bins];
+
+        void merge(const BinGrid &other)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                for (int b = 0; b < bins; b++)
+                {
+                    cells[axis][b].box = grow(cells[axis][b].box, other.cells[axis][b].box);
+                    cells[axis][b].count += other.cells[axis][b].count;
+                }
+            }
+        }
+    };
+
+    struct BuildContext
+    {
+        const std::vector<AABB> &bounds;
+        std::atomic<int> idle; // Build threads with nothing to do
+
+        BuildContext(const std::vector<AABB> &b, int threads) : bounds(b), idle(threads - 1) {}
+
+        // Takes up to `wanted` idle threads and returns how many it got
+        int claim(int wanted)
+        {
+            int available = idle.load();
+            while (available > 0 && wanted > 0)
+            {
+                int taken = std::min(available, wanted);
+                if (idle.compare_exchange_weak(available, available - taken))
+                    return taken;
+            }
+            return 0;
+        }
+
+        void release(int threads) { idle += threads; }
+    };
+
+    static AABB emptyBox()
+    {
+        return AABB(Point3(infinity, infinity, infinity), Point3(-infinity, -infinity, -infinity));
+    }
+
+    // surroundingBox without fmin's NaN handling, which primitive bounds
+    // never need, and which makes it a library call instead of one instruction
+    static AABB grow(const AABB &a, const AABB &b)
+    {
+        Point3 lo(std::min(a.min().x(), b.min().x()), std::min(a.min().y(), b.min().y()), std::min(a.min().z(), b.min().z()));
+        Point3 hi(std::max(a.max().x(), b.max().x()), std::max(a.max().y(), b.max().y()), std::max(a.max().z(), b.max().z()));
+        return AABB(lo, hi);
+    }
+
+    static double surfaceArea(const AABB &box)
+    {
+        Vec3 d = box.max() - box.min();
+        return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    static float roundDown(double x)
+    {
+        float f = static_cast<float>(x);
+        return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float roundUp(double x)
+    {
+        float f = static_cast<float>(x);
+        return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    // Runs slice(first, last, partial) over [begin, end) and merges the
+    // partial results. Large ranges are cut into slices of at least a quarter
+    // of parallelNode, shared with as many idle threads as are available.
+    template <typename Result, typename Slice>
+    static Result reduce(BuildContext &context, size_t begin, size_t end, Slice &&slice)
+    {
+        Result result;
+        size_t count = end - begin;
+        int helpers = count >= parallelNode ? context.claim(static_cast<int>(count / (parallelNode / 4)) - 1) : 0;
+        if (helpers == 0)
+        {
+            slice(begin, end, result);
+            return result;
+        }
+
+        size_t parts = helpers + 1;
+        std::vector<Result> partial(parts);
+        std::vector<std::thread> workers;
+        for (size_t part = 1; part < parts; part++)
+            workers.emplace_back([&, part]()
+                                 { slice(begin + count * part / parts, begin + count * (part + 1) / parts, partial[part]); });
+        slice(begin, begin + count / parts, result);
+        for (auto &worker : workers)
+            worker.join();
+        context.release(helpers);
+
+        for (size_t part = 1; part < parts; part++)
+            result.merge(partial[part]);
+        return result;
+    }
+
+    static void makeLeaf(std::vector<BVHNode> &out, size_t nodeIndex, size_t begin, size_t end)
+    {
+        out[nodeIndex].offset = static_cast<uint32_t>(begin);
+        out[nodeIndex].count = static_cast<uint16_t>(end - begin);
+    }
+
+    // Builds the subtree over primIndices[begin, end) into out[nodeIndex] and
+    // the nodes appended after it. Interior offsets index `out`; `depth` is
+    // the level of out[nodeIndex] in the whole tree.
+    void buildRecursive(BuildContext &context, std::vector<BVHNode> &out, size_t nodeIndex, size_t begin, size_t end, int depth)
+    {
+        const std::vector<AABB> &bounds = context.bounds;
+        Extent extent = reduce<Extent>(context, begin, end,
+                                       [&](size_t first, size_t last, Extent &result)
+                                       {
+                                           for (size_t i = first; i < last; i++)
+                                           {
+                                               uint32_t prim = primIndices[i];
+                                               result.box = grow(result.box, bounds[prim]);
+                                               result.centroidBox = grow(result.centroidBox, AABB(centroids[prim], centroids[prim]));
+                                           }
+                                       });
+        const AABB &box = extent.box;
+        const AABB &centroidBox = extent.centroidBox;
+
+        BVHNode &node = out[nodeIndex];
+        for (int i = 0; i < 3; i++)
+        {
+            node.bmin[i] = roundDown(box.min()[i]);
+            node.bmax[i] = roundUp(box.max()[i]);
+        }
+        node.count = 0;
+        node.axis = 0;
+
+        size_t count = end - begin;
+        if (count <= 1)
+        {
+            makeLeaf(out, nodeIndex, begin, end);
+            return;
+        }
+
+        // Bin centroids along every axis in one pass, then sweep each axis
+        // for the cheapest split.
+        double lo[3], scale[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            lo[axis] = centroidBox.min()[axis];
+            double width = centroidBox.max()[axis] - lo[axis];
+            scale[axis] = width > 0 ? bins / width : 0;
+        }
+        BinGrid grid = reduce<BinGrid>(context, begin, end,
+                                       [&](size_t first, size_t last, BinGrid &result)
+                                       {
+                                           for (size_t i = first; i < last; i++)
+                                           {
+                                               uint32_t prim = primIndices[i];
+                                               for (int axis = 0; axis < 3; axis++)
+                                               {
+                                                   if (scale[axis] == 0)
+                                                       continue;
+                                                   int b = std::min(static_cast<int>((centroids[prim][axis] - lo[axis]) * scale[axis]), bins - 1);
+                                                   result.cells[axis][b].count++;
+                                                   result.cells[axis][b].box = grow(result.cells[axis][b].box, bounds[prim]);
+                                               }
+                                           }
+                                       });
+
+        double bestCost = infinity;
+        int bestAxis = -1;
+        int bestSplit = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (scale[axis] == 0)
+                continue;
+            const Bin *binArray = grid.cells[axis];
+
+            double rightArea[bins];
+            uint32_t rightCount[bins];
+            AABB accumulated = emptyBox();
+            uint32_t accumulatedCount = 0;
+            for (int b = bins - 1; b > 0; b--)
+            {
+                accumulated = grow(accumulated, binArray[b].box);
+                accumulatedCount += binArray[b].count;
+                rightArea[b] = accumulatedCount ? surfaceArea(accumulated) : 0;
+                rightCount[b] = accumulatedCount;
+            }
+
+            accumulated = emptyBox();
+            accumulatedCount = 0;
+            for (int b = 0; b < bins - 1; b++)
+            {
+                accumulated = grow(accumulated, binArray[b].box);
+                accumulatedCount += binArray[b].count;
+                if (accumulatedCount == 0 || rightCount[b + 1] == 0)
+                    continue;
+                double cost = surfaceArea(accumulated) * accumulatedCount + rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        double leafCost = static_cast<double>(count);
+        double splitCost = traversalCost + bestCost / surfaceArea(box);
+
+        size_t mid;
+        if (bestAxis < 0)
+        {
+            // Every centroid coincides, binning cannot separate them.
+            if (count <= maxLeafSize)
+            {
+                makeLeaf(out, nodeIndex, begin, end);
+                return;
+            }
+            mid = begin + count / 2;
+        }
+        else
+        {
+            if (count <= maxLeafSize && splitCost >= leafCost)
+            {
+                makeLeaf(out, nodeIndex, begin, end);
+                return;
+            }
+
+            double axisLo = lo[bestAxis];
+            double axisScale = scale[bestAxis];
+            auto middle = std::partition(primIndices.begin() + begin, primIndices.begin() + end,
+                                         [&](uint32_t prim)
+                                         {
+                                             int b = std::min(static_cast<int>((centroids[prim][bestAxis] - axisLo) * axisScale), bins - 1);
+                                             return b <= bestSplit;
+                                         });
+            mid = middle - primIndices.begin();
+            out[nodeIndex].axis = static_cast<uint16_t>(bestAxis);
+        }
+
+        // Keeps the tree within maxDepth. A node of n primitives needs
+        // ceil(log2 n) levels below it when split at the median, so a split
+        // whose larger half could not finish in the levels left is replaced
+        // by a median split along the widest centroid axis. That keeps every
+        // node within 2^(levels left) primitives, which the root satisfies.
+        int levelsLeft = maxDepth - 1 - depth;
+        if (std::max(mid - begin, end - mid) > size_t(1) << (levelsLeft - 1))
+        {
+            Vec3 spread = centroidBox.max() - centroidBox.min();
+            int axis = spread.x() >= spread.y() && spread.x() >= spread.z() ? 0 : (spread.y() >= spread.z() ? 1 : 2);
+            mid = begin + count / 2;
+            std::nth_element(primIndices.begin() + begin, primIndices.begin() + mid, primIndices.begin() + end,
+                             [&](uint32_t a, uint32_t b)
+                             { return centroids[a][axis] < centroids[b][axis]; });
+            out[nodeIndex].axis = static_cast<uint16_t>(axis);
+        }
+
+        // A large right half is built by an idle thread into an array of its
+        // own, appended after the left half so the layout matches a serial build.
+        std::vector<BVHNode> rightNodes;
+        std::thread rightBuilder;
+        if (end - mid >= parallelSubtree && context.claim(1))
+        {
+            rightBuilder = std::thread([&]()
+                                       {
+                                           rightNodes.reserve(2 * (end - mid) / maxLeafSize + 1);
+                                           rightNodes.emplace_back();
+                                           buildRecursive(context, rightNodes, 0, mid, end, depth + 1); });
+        }
+
+        size_t left = out.size();
+        out.emplace_back();
+        buildRecursive(context, out, left, begin, mid, depth + 1);
+
+        size_t right = out.size();
+        out[nodeIndex].offset = static_cast<uint32_t>(right);
+        if (rightBuilder.joinable())
+        {
+            rightBuilder.join();
+            context.release(1);
+            for (BVHNode child : rightNodes)
+            {
+                if (!child.isLeaf())
+                    child.offset += static_cast<uint32_t>(right);
+                out.push_back(child);
+            }
+        }
+        else
+        {
+            out.emplace_back();
+            buildRecursive(context, out, right, mid, end, depth + 1);
+        }
+    }
+};
+
+// Hittable front end over BVHTree for arbitrary primitives.
+class BVH : public Hittable
+{
+private:
+    BVHTree tree;
+    std::vector<shared_ptr<Hittable>> primitives; // In leaf order
+
+public:
+    BVH() {}
+    BVH(const HittableList &list, double time0 = 0, double time1 = 0)
+    {
+        std::vector<AABB> bounds(list.objects.size());
+        for (size_t i = 0; i < list.objects.size(); i++)
+        {
+            if (!list.objects[i]->boundingBox(time0, time1, bounds[i]))
+                std::cerr << "No bounding box in BVH constructor.\n";
+        }
+
+        tree.build(bounds);
+
+        primitives.reserve(list.objects.size());
+        for (uint32_t index : tree.primIndices)
+            primitives.push_back(list.objects[index]);
+    }
+
+    size_t nodeCount() const { return tree.nodes.size(); }
+
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override;
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override;
+    virtual int hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const override;
+};
+
+bool BVH::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
+{
+    return tree.traverse(ray, t_min, t_max,
+                         [&](uint32_t first, uint32_t count, double &closest)
+                         {
+                             bool hitAnything = false;
+                             for (uint32_t i = first; i < first + count; i++)
+                             {
+                                 if (primitives[i]->intersect(ray, t_min, closest, point))
+                                 {
+                                     hitAnything = true;
+                                     closest = point.t;
+                                 }
+                             }
+                             return hitAnything;
+                         });
+}
+
+bool BVH::occluded(const Ray &ray, double t_min, double t_max) const
+{
+    return tree.traverseAny(ray, t_min, t_max,
+                            [&](uint32_t first, uint32_t count)
+                            {
+                                for (uint32_t i = first; i < first + count; i++)
+                                {
+                                    if (primitives[i]->occluded(ray, t_min, t_max))
+                                        return true;
+                                }
+                                return false;
+                            });
+}
+
+bool BVH::boundingBox(double time0, double time1, AABB &OutBox) const
+{
+    if (tree.empty())
+        return false;
+    OutBox = tree.bounds();
+    return true;
+}
+
+int BVH::hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const
+{
+    return tree.traversePacket(packet, mask, t_min, t_max,
+                               [&](uint32_t first, uint32_t count, int active, double closest[])
+                               {
+                                   int hitMask = 0;
+                                   for (uint32_t i = first; i < first + count; i++)
+                                       hitMask |= primitives[i]->hitPacket(packet, active, t_min, closest, recs);
+                                   return hitMask;
+                               });
+}
@@ -0,0 +1,563 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "Commons.h"
+#include "Hittable.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "FlatScene.h"
+#include "TriangleMesh.h"
+#include "ObjLoader.h"
+#include "Instance.h"
+#include "Camera.h"
+
+// Wall-clock seconds taken by fn()
+inline double time_seconds(const std::function<void()> &fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Runs fn(threadIndex) on `threads` threads and returns the wall-clock time.
+inline double time_parallel(int threads, const std::function<void(int)> &fn)
+{
+    return time_seconds([&]()
+                        {
+                            std::vector<std::thread> pool;
+                            for (int t = 1; t < threads; t++)
+                                pool.emplace_back(fn, t);
+                            fn(0);
+                            for (auto &thread : pool)
+                                thread.join(); });
+}
+
+// Bytes currently allocated through malloc, including mmapped blocks. Only
+// glibc reports them; elsewhere this returns false.
+inline bool heap_bytes(size_t &bytes)
+{
+    bytes = 0;
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+    bytes = info.uordblks + info.hblkhd;
+    return true;
+#endif
+#endif
+    return false;
+}
+
+// Throughput of the legacy rand() path against the thread-local PCG sampler.
+inline void bench_rng(int threads)
+{
+    const size_t draws = 50000000;
+    std::vector<double> sinks(threads);
+
+    auto legacy = [&](int id)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < draws / threads; i++)
+            sum += rand() / (RAND_MAX + 1.0);
+        sinks[id] = sum;
+    };
+
+    auto sampler = [&](int id)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < draws / threads; i++)
+            sum += random_double();
+        sinks[id] = sum;
+    };
+
+    double legacy1 = time_parallel(1, legacy);
+    double sampler1 = time_parallel(1, sampler);
+    double legacyN = time_parallel(threads, legacy);
+    double samplerN = time_parallel(threads, sampler);
+
+    auto rate = [&](double seconds)
+    { return draws / seconds / 1e6; };
+
+    printf("rng: %zu draws\n", draws);
+    printf("  rand()          1 thread : %8.1f Mdraws/s\n", rate(legacy1));
+    printf("  Pcg32 sampler   1 thread : %8.1f Mdraws/s\n", rate(sampler1));
+    printf("  rand()        %3d threads: %8.1f Mdraws/s\n", threads, rate(legacyN));
+    printf("  Pcg32 sampler %3d threads: %8.1f Mdraws/s\n", threads, rate(samplerN));
+    printf("  (checksum %f)\n", sinks[0]);
+}
+
+// Nanoseconds per call of the Vec3 kernels the renderer leans on, over
+// operands that stay in L1, to compare the scalar and padded SIMD layouts.
+inline void bench_vec3()
+{
+    const size_t count = 1024;
+    const int rounds = 20000;
+    std::vector<Vec3> a(count), b(count), c(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        a[i] = Vec3::random(-1, 1);
+        b[i] = Vec3::random(-1, 1);
+        c[i] = random_unit_vector();
+    }
+
+    Vec3 sink;
+    auto run = [&](const char *name, const std::function<void()> &kernel)
+    {
+        double seconds = time_seconds(kernel);
+        printf("  %-22s %6.2f ns\n", name, seconds * 1e9 / (static_cast<double>(count) * rounds));
+    };
+
+    printf("vec3: %s, %s layout, %zu bytes\n", real_name,
+#ifdef VEC3_SIMD
+           "padded SIMD",
+#else
+           "scalar",
+#endif
+           sizeof(Vec3));
+    run("add, scale", [&]()
+        {
+            Vec3 sum;
+            for (int r = 0; r < rounds; r++)
+                for (size_t i = 0; i < count; i++)
+                    sum += 0.5 * (a[i] + b[i]);
+            sink += sum; });
+    run("dot, cross", [&]()
+        {
+            real sum = 0;
+            for (int r = 0; r < rounds; r++)
+                for (size_t i = 0; i < count; i++)
+                    sum += dot(cross(a[i], b[i]), c[i]);
+            sink += Vec3(sum, 0, 0); });
+    run("unit_vector", [&]()
+        {
+            Vec3 sum;
+            for (int r = 0; r < rounds; r++)
+                for (size_t i = 0; i < count; i++)
+                    sum += unit_vector(a[i]);
+            sink += sum; });
+    run("unit_vector_fast", [&]()
+        {
+            Vec3 sum;
+            for (int r = 0; r < rounds; r++)
+                for (size_t i = 0; i < count; i++)
+                    sum += unit_vector_fast(a[i]);
+            sink += sum; });
+    run("reflect", [&]()
+        {
+            Vec3 sum;
+            for (int r = 0; r < rounds; r++)
+                for (size_t i = 0; i < count; i++)
+                    sum += reflect(a[i], c[i]);
+            sink += sum; });
+    run("surroundingBox", [&]()
+        {
+            AABB box(a[0], a[0]);
+            for (int r = 0; r < rounds; r++)
+                for (size_t i = 0; i < count; i++)
+                    box = surroundingBox(box, AABB(component_min(a[i], b[i]), component_max(a[i], b[i])));
+            sink += box.max() - box.min(); });
+    run("triangle test", [&]()
+        {
+            // Moller-Trumbore for a ray from the origin along c[i]
+            size_t hits = 0;
+            for (int r = 0; r < rounds; r++)
+            {
+                for (size_t i = 0; i + 2 < count; i++)
+                {
+                    Vec3 edge1 = a[i + 1] - a[i], edge2 = a[i + 2] - a[i];
+                    Vec3 pvec = cross(c[i], edge2);
+                    real invDet = 1 / dot(edge1, pvec);
+                    Vec3 tvec = -a[i];
+                    real b1 = dot(tvec, pvec) * invDet;
+                    Vec3 qvec = cross(tvec, edge1);
+                    real b2 = dot(c[i], qvec) * invDet;
+                    hits += b1 >= 0 && b2 >= 0 && b1 + b2 <= 1 && dot(edge2, qvec) * invDet > 0;
+                }
+            }
+            sink += Vec3(static_cast<real>(hits), 0, 0); });
+    printf("  (checksum %f)\n", sink.x() + sink.y() + sink.z());
+}
+
+// Closest-hit throughput for rays leaving random points inside `extent`
+// (a box centred on the origin) in random directions.
+template <typename World>
+inline void bench_hit(const char *sceneName, const World &world, const Vec3 &extent, size_t rayCount = 1000000)
+{
+    const int rounds = 5;
+
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    for (size_t i = 0; i < rayCount; i++)
+    {
+        Point3 origin(random_double(-1, 1) * extent.x(),
+                      random_double(-1, 1) * extent.y(),
+                      random_double(-1, 1) * extent.z());
+        rays.emplace_back(origin, random_unit_vector());
+    }
+
+    size_t hits = 0;
+    double seconds = time_seconds([&]()
+                                  {
+                                      HitRecord rec;
+                                      for (int round = 0; round < rounds; round++)
+                                          for (const Ray &ray : rays)
+                                              hits += world.hit(ray, ray_t_min, infinity, rec); });
+
+    printf("hit: %s, %zu rays x %d rounds\n", sceneName, rayCount, rounds);
+    printf("  %8.2f Mrays/s (%zu hits)\n", rayCount * rounds / seconds / 1e6, hits);
+}
+
+// BVH build time over the bounds of `count` random spheres for each thread
+// count, checking that every thread count builds the same tree as the first.
+inline void bench_build(size_t count, const std::vector<int> &threadCounts)
+{
+    begin_sample(0, count, 2);
+    double extent = cbrt(static_cast<double>(count));
+    std::vector<AABB> bounds(count);
+    for (AABB &box : bounds)
+    {
+        Point3 center = Vec3::random(-extent, extent);
+        double radius = random_double(0.1, 0.4);
+        Vec3 r(radius, radius, radius);
+        box = AABB(center - r, center + r);
+    }
+
+    printf("build: %zu primitives\n", count);
+    int savedThreads = BVHTree::buildThreads;
+    double firstSeconds = 0;
+    uint64_t firstHash = 0;
+    for (int threads : threadCounts)
+    {
+        BVHTree::buildThreads = threads;
+        BVHTree tree;
+        double seconds = time_seconds([&]()
+                                      { tree.build(bounds); });
+
+        // FNV-1a over the nodes and the leaf order
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&](const void *data, size_t bytes)
+        {
+            for (size_t i = 0; i < bytes; i++)
+                hash = (hash ^ static_cast<const unsigned char *>(data)[i]) * 1099511628211ull;
+        };
+        mix(tree.nodes.data(), tree.nodes.size() * sizeof(BVHNode));
+        mix(tree.primIndices.data(), tree.primIndices.size() * sizeof(uint32_t));
+
+        if (threads == threadCounts.front())
+        {
+            firstSeconds = seconds;
+            firstHash = hash;
+        }
+        printf("  %3d threads %8.3f s, speedup %5.2f, %zu nodes%s\n", threads, seconds, firstSeconds / seconds,
+               tree.nodes.size(), hash == firstHash ? "" : ", DIFFERENT TREE");
+    }
+    BVHTree::buildThreads = savedThreads;
+}
+
+// BVH build time followed by closest-hit throughput through the built tree.
+inline void bench_bvh(const char *sceneName, const HittableList &scene, const Vec3 &extent)
+{
+    shared_ptr<BVH> bvh;
+    double buildSeconds = time_seconds([&]()
+                                       { bvh = make_shared<BVH>(scene); });
+
+    printf("bvh: %s, %zu primitives\n", sceneName, scene.objects.size());
+    printf("  build %8.3f s, %zu nodes\n", buildSeconds, bvh->nodeCount());
+    bench_hit(sceneName, *bvh, extent);
+}
+
+// Primary-ray throughput of scalar hit() against 2x2 packets through hitPacket().
+inline void bench_packet(const char *sceneName, const Hittable &world, const Camera &cam)
+{
+    const int width = 640;
+    const int height = 480;
+    const int rounds = 5;
+
+    std::vector<RayPacket> packets;
+    for (int y = 0; y < height; y += 2)
+    {
+        for (int x = 0; x < width; x += 2)
+        {
+            RayPacket packet;
+            for (int lane = 0; lane < RayPacket::size; lane++)
+            {
+                double u = (x + (lane & 1) + random_double()) / (width - 1);
+                double v = (y + (lane >> 1) + random_double()) / (height - 1);
+                packet.set(lane, cam.getRay(u, v));
+            }
+            packets.push_back(packet);
+        }
+    }
+    size_t rayCount = packets.size() * RayPacket::size;
+
+    size_t scalarHits = 0;
+    double scalarSeconds = time_seconds([&]()
+                                        {
+                                            HitRecord rec;
+                                            for (int round = 0; round < rounds; round++)
+                                                for (const RayPacket &packet : packets)
+                                                    for (const Ray &ray : packet.rays)
+                                                        scalarHits += world.hit(ray, ray_t_min, infinity, rec); });
+
+    size_t packetHits = 0;
+    double packetSeconds = time_seconds([&]()
+                                        {
+                                            HitRecord recs[RayPacket::size];
+                                            for (int round = 0; round < rounds; round++)
+                                            {
+                                                for (const RayPacket &packet : packets)
+                                                {
+                                                    alignas(32) double t_max[RayPacket::size] = {infinity, infinity, infinity, infinity};
+                                                    packetHits += __builtin_popcount(world.hitPacket(packet, packet.active, ray_t_min, t_max, recs));
+                                                }
+                                            } });
+
+    printf("packet: %s, %dx%d primary rays x %d rounds\n", sceneName, width, height, rounds);
+    printf("  scalar %8.2f Mrays/s (%zu hits)\n", rayCount * rounds / scalarSeconds / 1e6, scalarHits);
+    printf("  packet %8.2f Mrays/s (%zu hits)\n", rayCount * rounds / packetSeconds / 1e6, packetHits);
+}
+
+// Binary BVH against the collapsed BVH4 on the same primitives.
+inline void bench_wide(const char *sceneName, const HittableList &scene, const Vec3 &extent)
+{
+    shared_ptr<BVH> binary;
+    shared_ptr<BVH4> wide;
+    double binarySeconds = time_seconds([&]()
+                                        { binary = make_shared<BVH>(scene); });
+    double wideSeconds = time_seconds([&]()
+                                      { wide = make_shared<BVH4>(scene); });
+
+    printf("wide: %s, %zu primitives\n", sceneName, scene.objects.size());
+    printf("  bvh  build %8.3f s, %zu nodes of %zu bytes\n", binarySeconds, binary->nodeCount(), sizeof(BVHNode));
+    printf("  bvh4 build %8.3f s, %zu nodes of %zu bytes\n", wideSeconds, wide->nodeCount(), sizeof(BVH4Node));
+
+    // Re-seed so both structures see the same rays.
+    begin_sample(0, 0, 0);
+    bench_hit("bvh", *binary, extent, 200000);
+    begin_sample(0, 0, 0);
+    bench_hit("bvh4", *wide, extent, 200000);
+}
+
+// Hittable-per-object BVH against the structure-of-arrays FlatScene.
+inline void bench_flat(const char *sceneName, const HittableList &scene, const Vec3 &extent)
+{
+    shared_ptr<BVH> bvh;
+    shared_ptr<FlatScene> flat;
+    double bvhSeconds = time_seconds([&]()
+                                     { bvh = make_shared<BVH>(scene); });
+    double flatSeconds = time_seconds([&]()
+                                      { flat = make_shared<FlatScene>(scene); });
+
+    printf("flat: %s, %zu primitives\n", sceneName, scene.objects.size());
+    // Object, its shared_ptr control block unless it is in an arena, and the
+    // pointers held by the list and the BVH
+    size_t controlBlock = scene.arena ? 0 : 16;
+    size_t bvhBytes = scene.objects.size() * (sizeof(Sphere) + controlBlock + 2 * sizeof(shared_ptr<Hittable>)) +
+                      bvh->nodeCount() * sizeof(BVHNode);
+    printf("  bvh  build %8.3f s, ~%.1f MB (%.1f bytes per primitive)\n", bvhSeconds,
+           bvhBytes / 1e6, static_cast<double>(bvhBytes) / scene.objects.size());
+    printf("  flat build %8.3f s, %.1f MB (%.1f bytes per primitive)\n", flatSeconds,
+           flat->memoryBytes() / 1e6, static_cast<double>(flat->memoryBytes()) / scene.objects.size());
+
+    begin_sample(0, 0, 0);
+    bench_hit("bvh", *bvh, extent, 200000);
+    begin_sample(0, 0, 0);
+    bench_hit("flat", *flat, extent, 200000);
+}
+
+// The same scene built with make_shared per object and from a SceneArena:
+// construction, BVH build and teardown times, the heap taken by the scene
+// where malloc reports it, and closest-hit throughput through a BVH over each.
+inline void bench_arena(const char *sceneName, const std::function<HittableList(bool pooled)> &makeScene, const Vec3 &extent)
+{
+    printf("arena: %s\n", sceneName);
+    for (bool pooled : {false, true})
+    {
+        HittableList scene;
+        shared_ptr<BVH> bvh;
+        size_t heapBefore, heapAfter;
+        bool measured = heap_bytes(heapBefore);
+        double sceneSeconds = time_seconds([&]()
+                                           { scene = makeScene(pooled); });
+        measured = heap_bytes(heapAfter) && measured;
+        size_t sceneBytes = heapAfter - heapBefore;
+        double buildSeconds = time_seconds([&]()
+                                           { bvh = make_shared<BVH>(scene); });
+        size_t primitives = scene.objects.size();
+
+        printf("  %s: %zu primitives\n", pooled ? "arena" : "heap ", primitives);
+        if (measured)
+            printf("    scene %8.3f s, %.1f MB (%.1f bytes per primitive)\n", sceneSeconds,
+                   sceneBytes / 1e6, static_cast<double>(sceneBytes) / primitives);
+        else
+            printf("    scene %8.3f s, heap usage not available on this platform\n", sceneSeconds);
+        if (scene.arena)
+            printf("    arena %.1f MB used of %.1f MB in %zu chunks\n", scene.arena->bytesUsed() / 1e6,
+                   scene.arena->bytesReserved() / 1e6, scene.arena->chunkCount());
+        printf("    bvh   %8.3f s\n", buildSeconds);
+
+        begin_sample(0, 0, 0);
+        bench_hit(pooled ? "arena bvh" : "heap bvh", *bvh, extent, 200000);
+
+        double freeSeconds = time_seconds([&]()
+                                          {
+                                              bvh.reset();
+                                              scene = HittableList(); });
+        printf("    free  %8.3f s\n", freeSeconds);
+    }
+}
+
+// Random segment queries answered by closest-hit hit() against any-hit
+// occluded(); both must agree on which segments are blocked.
+inline void bench_occluded(const char *sceneName, const Hittable &world, const Vec3 &extent, size_t segmentCount = 200000)
+{
+    const int rounds = 5;
+
+    begin_sample(0, 0, 0);
+    std::vector<Ray> segments;
+    segments.reserve(segmentCount);
+    for (size_t i = 0; i < segmentCount; i++)
+    {
+        Point3 from(random_double(-1, 1) * extent.x(), random_double(-1, 1) * extent.y(), random_double(-1, 1) * extent.z());
+        Point3 to(random_double(-1, 1) * extent.x(), random_double(-1, 1) * extent.y(), random_double(-1, 1) * extent.z());
+        segments.emplace_back(from, to - from);
+    }
+
+    size_t hitBlocked = 0, occludedBlocked = 0;
+    double hitSeconds = time_seconds([&]()
+                                     {
+                                         HitRecord rec;
+                                         for (int round = 0; round < rounds; round++)
+                                             for (const Ray &segment : segments)
+                                                 hitBlocked += world.hit(segment, ray_t_min, 1.0, rec); });
+    double occludedSeconds = time_seconds([&]()
+                                          {
+                                              for (int round = 0; round < rounds; round++)
+                                                  for (const Ray &segment : segments)
+                                                      occludedBlocked += world.occluded(segment, ray_t_min, 1.0); });
+
+    printf("occluded: %s, %zu segments x %d rounds, %.1f%% blocked\n", sceneName, segmentCount, rounds,
+           100.0 * hitBlocked / (segmentCount * rounds));
+    printf("  hit      %8.2f Mrays/s\n", segmentCount * rounds / hitSeconds / 1e6);
+    printf("  occluded %8.2f Mrays/s (%.2fx)%s\n", segmentCount * rounds / occludedSeconds / 1e6,
+           hitSeconds / occludedSeconds, hitBlocked == occludedBlocked ? "" : ", MISMATCH");
+}
+
+// Unit sphere split into about `triangleCount` triangles along rings and segments
+inline void tessellated_sphere(size_t triangleCount, std::vector<Point3> &vertices, std::vector<uint32_t> &indices)
+{
+    uint32_t rings = static_cast<uint32_t>(std::sqrt(triangleCount / 4.0)) + 1;
+    uint32_t segments = 2 * rings;
+
+    vertices.clear();
+    indices.clear();
+    for (uint32_t r = 0; r <= rings; r++)
+    {
+        double theta = pi * r / rings;
+        for (uint32_t s = 0; s < segments; s++)
+        {
+            double phi = 2 * pi * s / segments;
+            vertices.emplace_back(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+        }
+    }
+    for (uint32_t r = 0; r < rings; r++)
+    {
+        for (uint32_t s = 0; s < segments; s++)
+        {
+            uint32_t a = r * segments + s;
+            uint32_t b = r * segments + (s + 1) % segments;
+            for (uint32_t corner : {a, b, b + segments, a, b + segments, a + segments})
+                indices.push_back(corner);
+        }
+    }
+}
+
+// Writes a tessellated sphere to an OBJ file, then times reading it,
+// building the mesh and tracing it.
+inline void bench_mesh(size_t triangleCount, shared_ptr<Material> material)
+{
+    const char *fileName = "bench_mesh.obj";
+    std::vector<Point3> vertices;
+    std::vector<uint32_t> indices;
+    tessellated_sphere(triangleCount, vertices, indices);
+
+    std::FILE *file = std::fopen(fileName, "w");
+    if (!file)
+        return;
+    for (const Point3 &v : vertices)
+        std::fprintf(file, "v %.9f %.9f %.9f\n", v.x(), v.y(), v.z());
+    for (size_t i = 0; i < indices.size(); i += 3)
+        std::fprintf(file, "f %u %u %u\n", indices[i] + 1, indices[i + 1] + 1, indices[i + 2] + 1);
+    std::fclose(file);
+
+    ObjReader reader;
+    std::string error;
+    bool ok = true;
+    double readSeconds = time_seconds([&]()
+                                      { ok = reader.read(fileName, error); });
+    std::remove(fileName);
+    if (!ok)
+    {
+        printf("mesh: %s\n", error.c_str());
+        return;
+    }
+
+    shared_ptr<TriangleMesh> mesh;
+    double buildSeconds = time_seconds([&]()
+                                       { mesh = make_shared<TriangleMesh>(std::move(reader.vertices), std::move(reader.indices), material); });
+
+    printf("mesh: %zu triangles, %zu vertices\n", mesh->triangleCount(), mesh->vertexCount());
+    printf("  read  %8.3f s\n", readSeconds);
+    printf("  build %8.3f s, %.1f MB (%.1f bytes per triangle)\n", buildSeconds, mesh->memoryBytes() / 1e6,
+           static_cast<double>(mesh->memoryBytes()) / mesh->triangleCount());
+
+    begin_sample(0, 0, 0);
+    bench_hit("mesh", *mesh, Vec3(0.5, 0.5, 0.5), 200000);
+}
+
+// Scatters `instanceCount` randomly rotated and scaled copies of one
+// tessellated sphere through a cube and traces them through an InstanceSet.
+inline void bench_instances(size_t instanceCount, size_t triangleCount, shared_ptr<Material> material)
+{
+    std::vector<Point3> vertices;
+    std::vector<uint32_t> indices;
+    tessellated_sphere(triangleCount, vertices, indices);
+    auto mesh = make_shared<TriangleMesh>(std::move(vertices), std::move(indices), material);
+
+    begin_sample(0, instanceCount, 2);
+    double extent = 2 * cbrt(static_cast<double>(instanceCount));
+    std::vector<Instance> instances;
+    instances.reserve(instanceCount);
+    for (size_t i = 0; i < instanceCount; i++)
+    {
+        double size = random_double(0.3, 1.0);
+        Transform toWorld = Transform::translate(Vec3::random(-extent, extent)) *
+                            Transform::rotate(random_unit_vector(), random_double(0, 360)) *
+                            Transform::scale(Vec3(size, size, size));
+        instances.emplace_back(0, toWorld);
+    }
+
+    shared_ptr<InstanceSet> scene;
+    double buildSeconds = time_seconds([&]()
+                                       { scene = make_shared<InstanceSet>(std::vector<shared_ptr<Hittable>>{mesh}, std::move(instances)); });
+
+    size_t instanced = mesh->memoryBytes() + scene->memoryBytes();
+    double copied = static_cast<double>(mesh->memoryBytes()) * instanceCount;
+    printf("instance: %zu instances of a %zu-triangle mesh, %zu triangles in the scene\n", instanceCount,
+           mesh->triangleCount(), mesh->triangleCount() * instanceCount);
+    printf("  top-level build %8.3f s\n", buildSeconds);
+    printf("  memory %.1f MB (mesh %.1f MB, %.0f bytes per instance), copies would need %.1f MB\n", instanced / 1e6,
+           mesh->memoryBytes() / 1e6, static_cast<double>(scene->memoryBytes()) / instanceCount, copied / 1e6);
+
+    begin_sample(0, 0, 0);
+    bench_hit("instances", *scene, Vec3(extent, extent, extent), 200000);
+}
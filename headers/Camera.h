@@ -13,18 +13,24 @@ private:
     Vec3 vertical;
 
 public:
-    Camera(double vfov, double ar)
+    Camera(double vfov, double ar) : Camera(Point3(0, 0, 0), Point3(0, 0, -1), Vec3(0, 1, 0), vfov, ar) {}
+
+    Camera(Point3 lookfrom, Point3 lookat, Vec3 vup, double vfov, double ar)
     {
         auto theta = degrees_to_radians(vfov);
         auto h = tan(theta / 2);
         auto vp_height = 2.0 * h;
         auto vp_width = ar * vp_height;
-        double focal_length = 1;
 
-        origin = Point3(0, 0, 0);
-        horizontal = Vec3(vp_width, 0, 0);
-        vertical = Vec3(0, vp_height, 0);
-        lower_left_corner = origin - horizontal / 2 - vertical / 2 - Vec3(0, 0, focal_length);
+        // Orthonormal camera frame, looking down -w
+        Vec3 w = unit_vector(lookfrom - lookat);
+        Vec3 u = unit_vector(cross(vup, w));
+        Vec3 v = cross(w, u);
+
+        origin = lookfrom;
+        horizontal = vp_width * u;
+        vertical = vp_height * v;
+        lower_left_corner = origin - horizontal / 2 - vertical / 2 - w;
     }
 
     Ray getRay(double u, double v) const
@@ -3,9 +3,9 @@
 
 #include "Commons.h"
 #include "Vec3.h"
-#include <iostream>
 
-void write_color(std::ostream &out, Color pixel_color, int samples_per_pixel)
+// Writes the gamma-corrected [0,255] value of each color component to out[0..2].
+inline void write_color(unsigned char *out, Color pixel_color, int samples_per_pixel)
 {
     double r = pixel_color.x();
     double g = pixel_color.y();
@@ -16,8 +16,7 @@ void write_color(std::ostream &out, Color pixel_color, int samples_per_pixel)
     g = sqrt(scale * g);
     b = sqrt(scale * b);
 
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(256 * clamp(r, 0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0, 0.999)) << '\n';
-}
\ No newline at end of file
+    out[0] = static_cast<unsigned char>(256 * clamp(r, 0, 0.999));
+    out[1] = static_cast<unsigned char>(256 * clamp(g, 0, 0.999));
+    out[2] = static_cast<unsigned char>(256 * clamp(b, 0, 0.999));
+}
@@ -5,17 +5,48 @@
 #include <memory>
 #include <cstdlib>
 
+#include "Sampler.h"
+
 // Usings
 
 using std::make_shared;
 using std::shared_ptr;
 using std::sqrt;
 
+// Scalar type of the geometry and shading math: Vec3, Ray, AABB, the
+// primitives and the materials. Build with -DRT_FLOAT for single precision.
+// Acceleration structures, hit distances, the accumulator and the image
+// writers stay in double. The SIMD packet and FlatScene kernels compute in
+// `real` too. In a float build they match the scalar primitives bit for bit
+// only with -ffp-contract=off: GCC otherwise fuses the scalar float
+// multiply-adds, while the kernels round after every operation.
+#ifdef RT_FLOAT
+using real = float;
+const char *const real_name = "float";
+#else
+using real = double;
+const char *const real_name = "double";
+#endif
+
 // Constants
 
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
 
+// Self-intersection guards. Rays leaving a surface ignore hits nearer than
+// ray_t_min, and shadow rays stop short of the light by the fraction
+// shadow_margin; both hold in either precision for scenes within a few
+// hundred units of the origin. A surface meant to lie just in front of
+// another is moved by surface_offset, which has to stay above the spacing
+// of representable coordinates or the two surfaces coincide.
+const double ray_t_min = 0.001;
+const double shadow_margin = 1e-6;
+#ifdef RT_FLOAT
+const double surface_offset = 1e-5;
+#else
+const double surface_offset = 1e-8;
+#endif
+
 // Utility Functions
 
 inline double degrees_to_radians(double degrees)
@@ -25,7 +56,7 @@ inline double degrees_to_radians(double degrees)
 
 inline double random_double()
 {
-    return rand() / (RAND_MAX + 1.0);
+    return thread_sampler().nextDouble();
 }
 
 inline double random_double(double min, double max)
@@ -0,0 +1,530 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "Commons.h"
+#include "Vec3.h"
+#include "Ray.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "Sphere.h"
+#include "AARect.h"
+#include "BVH.h"
+
+// Sphere data as structure-of-arrays
+struct SphereArrays
+{
+    std::vector<double> cx, cy, cz, radius;
+    std::vector<uint32_t> material;
+
+    size_t size() const { return radius.size(); }
+
+    void push(const Point3 &center, double r, uint32_t mat)
+    {
+        cx.push_back(center.x());
+        cy.push_back(center.y());
+        cz.push_back(center.z());
+        radius.push_back(r);
+        material.push_back(mat);
+    }
+
+    AABB bounds(size_t i) const
+    {
+        Vec3 r(radius[i], radius[i], radius[i]);
+        Point3 center(cx[i], cy[i], cz[i]);
+        return AABB(center - r, center + r);
+    }
+
+    void permute(const std::vector<uint32_t> &order)
+    {
+        permuteArray(cx, order);
+        permuteArray(cy, order);
+        permuteArray(cz, order);
+        permuteArray(radius, order);
+        permuteArray(material, order);
+    }
+
+    size_t memoryBytes() const
+    {
+        return (cx.capacity() + cy.capacity() + cz.capacity() + radius.capacity()) * sizeof(double) +
+               material.capacity() * sizeof(uint32_t);
+    }
+
+    template <typename T>
+    static void permuteArray(std::vector<T> &values, const std::vector<uint32_t> &order)
+    {
+        std::vector<T> sorted(values.size());
+        for (size_t i = 0; i < order.size(); i++)
+            sorted[i] = values[order[i]];
+        values.swap(sorted);
+    }
+};
+
+// Axis-aligned rectangles of all three orientations as structure-of-arrays,
+// see RectBounds for the meaning of the fields.
+struct RectArrays
+{
+    std::vector<double> k, a0, a1, b0, b1;
+    std::vector<uint8_t> axis;
+    std::vector<uint32_t> material;
+
+    size_t size() const { return k.size(); }
+
+    void push(const RectBounds &rect, uint32_t mat)
+    {
+        k.push_back(rect.k);
+        a0.push_back(rect.a0);
+        a1.push_back(rect.a1);
+        b0.push_back(rect.b0);
+        b1.push_back(rect.b1);
+        axis.push_back(static_cast<uint8_t>(rect.axis));
+        material.push_back(mat);
+    }
+
+    AABB bounds(size_t i) const
+    {
+        double lo[3], hi[3];
+        lo[axis[i]] = k[i] - 1e-4;
+        hi[axis[i]] = k[i] + 1e-4;
+        lo[RectBounds::axisA(axis[i])] = a0[i];
+        hi[RectBounds::axisA(axis[i])] = a1[i];
+        lo[RectBounds::axisB(axis[i])] = b0[i];
+        hi[RectBounds::axisB(axis[i])] = b1[i];
+        return AABB(Point3(lo[0], lo[1], lo[2]), Point3(hi[0], hi[1], hi[2]));
+    }
+
+    void permute(const std::vector<uint32_t> &order)
+    {
+        SphereArrays::permuteArray(k, order);
+        SphereArrays::permuteArray(a0, order);
+        SphereArrays::permuteArray(a1, order);
+        SphereArrays::permuteArray(b0, order);
+        SphereArrays::permuteArray(b1, order);
+        SphereArrays::permuteArray(axis, order);
+        SphereArrays::permuteArray(material, order);
+    }
+
+    size_t memoryBytes() const
+    {
+        return (k.capacity() + a0.capacity() + a1.capacity() + b0.capacity() + b1.capacity()) * sizeof(double) +
+               axis.capacity() + material.capacity() * sizeof(uint32_t);
+    }
+};
+
+// Read-only pointers to the arrays FlatScene intersects, pointing either into
+// its own vectors or into a mapped scene cache
+struct FlatSceneView
+{
+    const double *cx = nullptr, *cy = nullptr, *cz = nullptr, *radius = nullptr;
+    const uint32_t *sphereMaterial = nullptr;
+    size_t sphereCount = 0;
+
+    const double *k = nullptr, *a0 = nullptr, *a1 = nullptr, *b0 = nullptr, *b1 = nullptr;
+    const uint8_t *axis = nullptr;
+    const uint32_t *rectMaterial = nullptr;
+    size_t rectCount = 0;
+
+    const BVHNode *sphereNodes = nullptr;
+    size_t sphereNodeCount = 0;
+    const BVHNode *rectNodes = nullptr;
+    size_t rectNodeCount = 0;
+};
+
+// Compact scene representation built from a HittableList. Spheres and rects
+// live in contiguous per-type arrays, each with its own BVH whose leaves are
+// contiguous ranges of those arrays, and are intersected by tight non-virtual
+// loops. Materials are deduplicated into a table. Hittables of any other type
+// are kept as they are and intersected through the virtual interface.
+// Intersection reads the arrays through a FlatSceneView, so a FlatScene can
+// also trace straight from arrays held in externally owned storage.
+class FlatScene : public Hittable
+{
+private:
+    std::vector<shared_ptr<Material>> materials;
+    std::vector<const Material *> materialTable;
+
+    SphereArrays spheres;
+    BVHTree sphereTree;
+    RectArrays rects;
+    BVHTree rectTree;
+    HittableList others;
+
+    FlatSceneView view;
+    shared_ptr<const void> storage; // Keeps external arrays alive
+
+public:
+    FlatScene() {}
+    FlatScene(const FlatScene &) = delete;
+    FlatScene &operator=(const FlatScene &) = delete;
+
+    // Traces from arrays owned by `owner`; material indices refer to `mats`.
+    FlatScene(const FlatSceneView &arrays, std::vector<shared_ptr<Material>> mats, shared_ptr<const void> owner)
+        : materials(std::move(mats)), view(arrays), storage(std::move(owner))
+    {
+        for (const auto &mat : materials)
+            materialTable.push_back(mat.get());
+    }
+
+    FlatScene(const HittableList &list)
+    {
+        std::unordered_map<const Material *, uint32_t> materialIndex;
+        auto addMaterial = [&](const shared_ptr<Material> &mat)
+        {
+            auto found = materialIndex.find(mat.get());
+            if (found != materialIndex.end())
+                return found->second;
+            uint32_t index = static_cast<uint32_t>(materials.size());
+            materials.push_back(mat);
+            materialTable.push_back(mat.get());
+            materialIndex.emplace(mat.get(), index);
+            return index;
+        };
+
+        for (const auto &object : list.objects)
+        {
+            if (auto sphere = dynamic_cast<const Sphere *>(object.get()))
+                spheres.push(sphere->getCenter(), sphere->getRadius(), addMaterial(sphere->getMaterial()));
+            else if (auto rect = dynamic_cast<const XYRect *>(object.get()))
+                rects.push(rect->bounds(), addMaterial(rect->getMaterial()));
+            else if (auto rect = dynamic_cast<const XZRect *>(object.get()))
+                rects.push(rect->bounds(), addMaterial(rect->getMaterial()));
+            else if (auto rect = dynamic_cast<const YZRect *>(object.get()))
+                rects.push(rect->bounds(), addMaterial(rect->getMaterial()));
+            else
+                others.add(object);
+        }
+
+        // Primitive tests here are cheap non-virtual loops over contiguous data,
+        // so leaves may hold more of them than in the Hittable BVH.
+        sphereTree.traversalCost = rectTree.traversalCost = 4.0;
+        sphereTree.maxLeafSize = rectTree.maxLeafSize = 16;
+        buildTree(spheres, sphereTree);
+        buildTree(rects, rectTree);
+        bindView();
+    }
+
+    size_t sphereCount() const { return view.sphereCount; }
+    size_t rectCount() const { return view.rectCount; }
+
+    const FlatSceneView &arrays() const { return view; }
+    const std::vector<shared_ptr<Material>> &materialList() const { return materials; }
+    bool hasOthers() const { return !others.objects.empty(); }
+
+    // Standalone copies of the primitives with a light material, for the LightList
+    HittableList emitters() const
+    {
+        HittableList result;
+        for (size_t i = 0; i < view.sphereCount; i++)
+            if (materialTable[view.sphereMaterial[i]]->isLight())
+                result.add(make_shared<Sphere>(Point3(view.cx[i], view.cy[i], view.cz[i]), view.radius[i],
+                                               materials[view.sphereMaterial[i]]));
+        for (size_t i = 0; i < view.rectCount; i++)
+        {
+            if (!materialTable[view.rectMaterial[i]]->isLight())
+                continue;
+            const shared_ptr<Material> &mat = materials[view.rectMaterial[i]];
+            if (view.axis[i] == 2)
+                result.add(make_shared<XYRect>(view.a0[i], view.a1[i], view.b0[i], view.b1[i], view.k[i], mat));
+            else if (view.axis[i] == 1)
+                result.add(make_shared<XZRect>(view.a0[i], view.a1[i], view.b0[i], view.b1[i], view.k[i], mat));
+            else
+                result.add(make_shared<YZRect>(view.a0[i], view.a1[i], view.b0[i], view.b1[i], view.k[i], mat));
+        }
+        for (const auto &object : others.objects)
+            result.add(object);
+        return result;
+    }
+
+    size_t memoryBytes() const
+    {
+        return spheres.memoryBytes() + rects.memoryBytes() +
+               (sphereTree.nodes.capacity() + rectTree.nodes.capacity()) * sizeof(BVHNode) +
+               materialTable.capacity() * sizeof(const Material *);
+    }
+
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual void fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const override;
+    virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override;
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override;
+
+private:
+    // HitPoint::index holds the array index with the primitive type in the top bit
+    enum : uint32_t
+    {
+        SphereHit = 0,
+        RectHit = 1u << 31,
+        KindMask = 1u << 31
+    };
+
+    void bindView()
+    {
+        view.cx = spheres.cx.data();
+        view.cy = spheres.cy.data();
+        view.cz = spheres.cz.data();
+        view.radius = spheres.radius.data();
+        view.sphereMaterial = spheres.material.data();
+        view.sphereCount = spheres.size();
+
+        view.k = rects.k.data();
+        view.a0 = rects.a0.data();
+        view.a1 = rects.a1.data();
+        view.b0 = rects.b0.data();
+        view.b1 = rects.b1.data();
+        view.axis = rects.axis.data();
+        view.rectMaterial = rects.material.data();
+        view.rectCount = rects.size();
+
+        view.sphereNodes = sphereTree.nodes.data();
+        view.sphereNodeCount = sphereTree.nodes.size();
+        view.rectNodes = rectTree.nodes.data();
+        view.rectNodeCount = rectTree.nodes.size();
+    }
+
+    // Builds the BVH and reorders the arrays into leaf order, after which leaf
+    // ranges index the arrays directly.
+    template <typename Arrays>
+    static void buildTree(Arrays &arrays, BVHTree &tree)
+    {
+        std::vector<AABB> bounds(arrays.size());
+        for (size_t i = 0; i < arrays.size(); i++)
+            bounds[i] = arrays.bounds(i);
+
+        tree.build(bounds);
+        arrays.permute(tree.primIndices);
+        tree.primIndices.clear();
+        tree.primIndices.shrink_to_fit();
+    }
+
+    // Nearest sphere in [first, first + count), same arithmetic as Sphere::hit.
+    // Computed in `real` like the primitives; the arrays hold values of that
+    // precision, so converting them is exact.
+    bool hitSpheres(const real o[3], const real d[3], real a, double t_min, double &t_max,
+                    uint32_t first, uint32_t count, uint32_t &best) const
+    {
+        bool found = false;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            real radius = view.radius[i];
+            real ocx = o[0] - real(view.cx[i]);
+            real ocy = o[1] - real(view.cy[i]);
+            real ocz = o[2] - real(view.cz[i]);
+            real half_b = ocx * d[0] + ocy * d[1] + ocz * d[2];
+            real s = half_b / a;
+            real lx = ocx - s * d[0], ly = ocy - s * d[1], lz = ocz - s * d[2];
+            real discriminant = a * (radius * radius - (lx * lx + ly * ly + lz * lz));
+            if (discriminant < 0)
+                continue;
+
+            real sqrtd = sqrt(discriminant);
+            real root = (-half_b - sqrtd) / a;
+            if (root < t_min || root > t_max)
+            {
+                root = (-half_b + sqrtd) / a;
+                if (root < t_min || root > t_max)
+                    continue;
+            }
+
+            t_max = root;
+            best = i;
+            found = true;
+        }
+        return found;
+    }
+
+    // Nearest rect in [first, first + count), same arithmetic as XYRect::hit.
+    bool hitRects(const real o[3], const real d[3], double t_min, double &t_max,
+                  uint32_t first, uint32_t count, uint32_t &best) const
+    {
+        bool found = false;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            int axis = view.axis[i];
+            int a = RectBounds::axisA(axis);
+            int b = RectBounds::axisB(axis);
+
+            real t = (real(view.k[i]) - o[axis]) / d[axis];
+            if (t < t_min || t > t_max)
+                continue;
+            real pa = o[a] + t * d[a];
+            real pb = o[b] + t * d[b];
+            if (pa < view.a0[i] || pa > view.a1[i] || pb < view.b0[i] || pb > view.b1[i])
+                continue;
+
+            t_max = t;
+            best = i;
+            found = true;
+        }
+        return found;
+    }
+
+    // Whether any sphere in [first, first + count) crosses [t_min, t_max]
+    bool anySphere(const real o[3], const real d[3], real a, double t_min, double t_max,
+                   uint32_t first, uint32_t count) const
+    {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            real radius = view.radius[i];
+            real ocx = o[0] - real(view.cx[i]);
+            real ocy = o[1] - real(view.cy[i]);
+            real ocz = o[2] - real(view.cz[i]);
+            real half_b = ocx * d[0] + ocy * d[1] + ocz * d[2];
+            real s = half_b / a;
+            real lx = ocx - s * d[0], ly = ocy - s * d[1], lz = ocz - s * d[2];
+            real discriminant = a * (radius * radius - (lx * lx + ly * ly + lz * lz));
+            if (discriminant < 0)
+                continue;
+
+            real sqrtd = sqrt(discriminant);
+            real near = (-half_b - sqrtd) / a;
+            real far = (-half_b + sqrtd) / a;
+            if ((near >= t_min && near <= t_max) || (far >= t_min && far <= t_max))
+                return true;
+        }
+        return false;
+    }
+
+    // Whether any rect in [first, first + count) crosses [t_min, t_max]
+    bool anyRect(const real o[3], const real d[3], double t_min, double t_max,
+                 uint32_t first, uint32_t count) const
+    {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            int axis = view.axis[i];
+            int a = RectBounds::axisA(axis);
+            int b = RectBounds::axisB(axis);
+
+            real t = (real(view.k[i]) - o[axis]) / d[axis];
+            if (t < t_min || t > t_max)
+                continue;
+            real pa = o[a] + t * d[a];
+            real pb = o[b] + t * d[b];
+            if (pa >= view.a0[i] && pa <= view.a1[i] && pb >= view.b0[i] && pb <= view.b1[i])
+                return true;
+        }
+        return false;
+    }
+
+    void sphereRecord(const Ray &ray, double t, uint32_t i, HitRecord &rec) const
+    {
+        Point3 center(view.cx[i], view.cy[i], view.cz[i]);
+        rec.t = t;
+        rec.p = ray.at(t);
+        Vec3 outward_normal = (rec.p - center) / view.radius[i];
+        rec.set_face_normal(ray, outward_normal);
+        Sphere::getSphereUV(outward_normal, rec.u, rec.v);
+        rec.mat_ptr = materialTable[view.sphereMaterial[i]];
+    }
+
+    void rectRecord(const Ray &ray, double t, uint32_t i, HitRecord &rec) const
+    {
+        int axis = view.axis[i];
+        double pa = ray.origin()[RectBounds::axisA(axis)] + t * ray.direction()[RectBounds::axisA(axis)];
+        double pb = ray.origin()[RectBounds::axisB(axis)] + t * ray.direction()[RectBounds::axisB(axis)];
+        rec.u = (pa - view.a0[i]) / (view.a1[i] - view.a0[i]);
+        rec.v = (pb - view.b0[i]) / (view.b1[i] - view.b0[i]);
+        rec.t = t;
+        Vec3 outward_normal(0, 0, 0);
+        outward_normal[axis] = 1;
+        rec.set_face_normal(ray, outward_normal);
+        rec.mat_ptr = materialTable[view.rectMaterial[i]];
+        rec.p = ray.at(t);
+    }
+};
+
+bool FlatScene::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
+{
+    const Point3 origin = ray.origin();
+    const Vec3 direction = ray.direction();
+    const real o[3] = {origin.x(), origin.y(), origin.z()};
+    const real d[3] = {direction.x(), direction.y(), direction.z()};
+    const real a = direction.length_squared();
+
+    bool found = false;
+    uint32_t kind = SphereHit;
+    uint32_t best = 0;
+    double closest = t_max;
+
+    BVHTree::traverse(view.sphereNodes, view.sphereNodeCount, ray, t_min, closest,
+                      [&](uint32_t first, uint32_t count, double &leafMax)
+                      {
+                          if (!hitSpheres(o, d, a, t_min, leafMax, first, count, best))
+                              return false;
+                          found = true;
+                          kind = SphereHit;
+                          closest = leafMax;
+                          return true;
+                      });
+
+    BVHTree::traverse(view.rectNodes, view.rectNodeCount, ray, t_min, closest,
+                      [&](uint32_t first, uint32_t count, double &leafMax)
+                      {
+                          if (!hitRects(o, d, t_min, leafMax, first, count, best))
+                              return false;
+                          found = true;
+                          kind = RectHit;
+                          closest = leafMax;
+                          return true;
+                      });
+
+    if (!others.objects.empty() && others.intersect(ray, t_min, closest, point))
+        return true;
+    if (!found)
+        return false;
+
+    point.t = closest;
+    point.object = this;
+    point.index = best | kind;
+    return true;
+}
+
+void FlatScene::fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const
+{
+    uint32_t index = point.index & ~KindMask;
+    if ((point.index & KindMask) == SphereHit)
+        sphereRecord(ray, point.t, index, rec);
+    else
+        rectRecord(ray, point.t, index, rec);
+}
+
+bool FlatScene::occluded(const Ray &ray, double t_min, double t_max) const
+{
+    const Point3 origin = ray.origin();
+    const Vec3 direction = ray.direction();
+    const real o[3] = {origin.x(), origin.y(), origin.z()};
+    const real d[3] = {direction.x(), direction.y(), direction.z()};
+    const real a = direction.length_squared();
+
+    return BVHTree::traverseAny(view.sphereNodes, view.sphereNodeCount, ray, t_min, t_max,
+                                [&](uint32_t first, uint32_t count)
+                                { return anySphere(o, d, a, t_min, t_max, first, count); }) ||
+           BVHTree::traverseAny(view.rectNodes, view.rectNodeCount, ray, t_min, t_max,
+                                [&](uint32_t first, uint32_t count)
+                                { return anyRect(o, d, t_min, t_max, first, count); }) ||
+           (!others.objects.empty() && others.occluded(ray, t_min, t_max));
+}
+
+bool FlatScene::boundingBox(double time0, double time1, AABB &OutBox) const
+{
+    bool found = false;
+    for (const BVHNode *root : {view.sphereNodeCount ? view.sphereNodes : nullptr,
+                                view.rectNodeCount ? view.rectNodes : nullptr})
+    {
+        if (!root)
+            continue;
+        AABB box(Point3(root->bmin[0], root->bmin[1], root->bmin[2]), Point3(root->bmax[0], root->bmax[1], root->bmax[2]));
+        OutBox = found ? surroundingBox(OutBox, box) : box;
+        found = true;
+    }
+
+    AABB othersBox;
+    if (!others.objects.empty())
+    {
+        if (!others.boundingBox(time0, time1, othersBox))
+            return false;
+        OutBox = found ? surroundingBox(OutBox, othersBox) : othersBox;
+        found = true;
+    }
+    return found;
+}
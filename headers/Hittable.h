@@ -1,18 +1,22 @@
 #pragma once
 
+#include <cstdint>
+
 #include "Ray.h"
 #include "AABB.h"
+#include "Packet.h"
 
 class Material;
+class Hittable;
 
 struct HitRecord
 {
     Point3 p;
     Vec3 normal;
-    shared_ptr<Material> mat_ptr;
+    const Material *mat_ptr; // Non-owning, the primitive keeps the material alive
     double t;
-    double u;
-    double v;
+    real u;
+    real v;
     bool front_face;
 
     inline void set_face_normal(const Ray &r, const Vec3 &outward_normal)
@@ -22,9 +26,72 @@ struct HitRecord
     }
 };
 
+// Result of the cheap first phase of intersection: the distance and the
+// primitive that can fill in the full HitRecord. `index` is for the
+// primitive's own use, e.g. an element of an array it holds. An instance
+// reports itself as `object` and keeps the hit on its shared geometry in
+// `inner` and `innerIndex`.
+struct HitPoint
+{
+    double t;
+    const Hittable *object;
+    uint32_t index;
+    uint32_t innerIndex;
+    const Hittable *inner;
+};
+
 class Hittable
 {
 public:
-    virtual bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const = 0;
+    // Closest hit in [t_min, t_max] without shading attributes. Must leave
+    // point untouched when returning false, callers pass the closest hit found
+    // so far straight through.
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const = 0;
+
+    // Shading attributes for a hit this object reported through intersect()
+    virtual void fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const {}
+
+    // Closest hit with its record, which is only computed for the winner.
+    // Leaves rec untouched when returning false.
+    virtual bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+    {
+        HitPoint point;
+        if (!intersect(ray, t_min, t_max, point))
+            return false;
+        point.object->fillRecord(ray, point, rec);
+        return true;
+    }
+
     virtual bool boundingBox(double time0, double time1, AABB &OutBox) const = 0;
+
+    // Whether anything is hit in [t_min, t_max]. Shadow rays only need that,
+    // so implementations may stop at the first hit.
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const
+    {
+        HitPoint point;
+        return intersect(ray, t_min, t_max, point);
+    }
+
+    // Closest hits for the packet lanes set in `mask`. Every lane that hits
+    // gets its record filled and t_max[lane] lowered to the hit distance.
+    // Returns the mask of lanes hit. Primitives override this with SIMD code.
+    virtual int hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const
+    {
+        int hitMask = 0;
+        for (int lane = 0; lane < RayPacket::size; lane++)
+        {
+            if ((mask >> lane & 1) && hit(packet.rays[lane], t_min, t_max[lane], recs[lane]))
+            {
+                t_max[lane] = recs[lane].t;
+                hitMask |= 1 << lane;
+            }
+        }
+        return hitMask;
+    }
+
+    // Light sampling, implemented by primitives that can carry a light
+    // material. randomDirection draws a direction from origin towards the
+    // primitive and pdfValue is the solid angle density of drawing direction.
+    virtual double pdfValue(const Point3 &origin, const Vec3 &direction) const { return 0.0; }
+    virtual Vec3 randomDirection(const Point3 &origin) const { return Vec3(1, 0, 0); }
 };
\ No newline at end of file
@@ -1,8 +1,11 @@
 #pragma once
 #include "Hittable.h"
 #include "AABB.h"
+#include "Profiler.h"
+#include "SceneArena.h"
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 using std::make_shared;
@@ -13,37 +16,77 @@ class HittableList : public Hittable
 public:
     HittableList() {}
     HittableList(shared_ptr<Hittable> object) { add(object); }
+    HittableList(const HittableList &) = default;
+    HittableList(HittableList &&) = default;
+
+    // Swaps so the old objects are released before the old arena
+    HittableList &operator=(HittableList other)
+    {
+        objects.swap(other.objects);
+        arena.swap(other.arena);
+        return *this;
+    }
 
     void clear() { objects.clear(); }
     void add(shared_ptr<Hittable> object) { objects.push_back(object); }
 
-    virtual bool hit(
-        const Ray &ray, double t_min, double t_max, HitRecord &rec) const override;
+    // A new object in the list's arena when it has one, on the heap otherwise
+    template <typename T, typename... Args>
+    shared_ptr<T> make(Args &&...args)
+    {
+        if (arena)
+            return arena->make<T>(std::forward<Args>(args)...);
+        return make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
     virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override;
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override;
+    virtual int hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const override;
 
 public:
+    shared_ptr<SceneArena> arena; // Shared by copies of the list, declared first so the objects go before it
     std::vector<shared_ptr<Hittable>> objects;
 };
 
-bool HittableList::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+bool HittableList::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
 {
-    HitRecord tempRecord;
     bool hitAnything = false;
     double closest_yet = t_max;
 
+    PROFILE_COUNT(primitiveTests, objects.size());
     for (const auto &object : objects)
     {
-        if (object->hit(ray, t_min, closest_yet, tempRecord))
+        if (object->intersect(ray, t_min, closest_yet, point))
         {
             hitAnything = true;
-            closest_yet = tempRecord.t;
-            rec = tempRecord;
+            closest_yet = point.t;
         }
     }
 
     return hitAnything;
 }
 
+bool HittableList::occluded(const Ray &ray, double t_min, double t_max) const
+{
+    for (const auto &object : objects)
+    {
+        PROFILE_COUNT(primitiveTests, 1);
+        if (object->occluded(ray, t_min, t_max))
+            return true;
+    }
+    return false;
+}
+
+int HittableList::hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const
+{
+    int hitMask = 0;
+    PROFILE_COUNT(primitiveTests, objects.size());
+    for (const auto &object : objects)
+        hitMask |= object->hitPacket(packet, mask, t_min, t_max, recs);
+    return hitMask;
+}
+
 bool HittableList::boundingBox(double time0, double time1, AABB &OutBox) const
 {
     if (objects.empty())
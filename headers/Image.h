@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Color.h"
+
+// Image writers. Each one formats the whole image into a single buffer and
+// hands it to the OS in one write; pixels are stored top row first.
+
+inline bool write_buffer(const std::string &fileName, const std::string &header, const std::vector<unsigned char> &body)
+{
+    std::FILE *file = std::fopen(fileName.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = std::fwrite(header.data(), 1, header.size(), file) == header.size() &&
+              std::fwrite(body.data(), 1, body.size(), file) == body.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// Binary 8-bit PPM (P6), gamma corrected
+inline bool write_ppm(const std::string &fileName, const std::vector<Color> &pixels, int width, int height, int samples_per_pixel)
+{
+    std::vector<unsigned char> body(pixels.size() * 3);
+    for (size_t i = 0; i < pixels.size(); i++)
+        write_color(&body[3 * i], pixels[i], samples_per_pixel);
+
+    std::string header = "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+    return write_buffer(fileName, header, body);
+}
+
+// Portable float map: linear little-endian RGB floats, rows bottom to top
+inline bool write_pfm(const std::string &fileName, const std::vector<Color> &pixels, int width, int height, int samples_per_pixel)
+{
+    std::vector<unsigned char> body(pixels.size() * 3 * sizeof(float));
+    float *out = reinterpret_cast<float *>(body.data());
+    double scale = 1.0 / samples_per_pixel;
+    for (int row = 0; row < height; row++)
+    {
+        const Color *in = &pixels[static_cast<size_t>(height - 1 - row) * width];
+        for (int i = 0; i < width; i++)
+        {
+            *out++ = static_cast<float>(in[i].x() * scale);
+            *out++ = static_cast<float>(in[i].y() * scale);
+            *out++ = static_cast<float>(in[i].z() * scale);
+        }
+    }
+
+    std::string header = "PF\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n-1.0\n";
+    return write_buffer(fileName, header, body);
+}
+
+// Reads a PFM written by write_pfm back into top-row-first pixels. Only
+// little-endian RGB maps of the expected size are accepted.
+inline bool read_pfm(const std::string &fileName, std::vector<Color> &pixels, int width, int height)
+{
+    std::FILE *file = std::fopen(fileName.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char magic[3] = {};
+    int w = 0, h = 0;
+    double scale = 0;
+    bool ok = std::fscanf(file, "%2s %d %d %lf", magic, &w, &h, &scale) == 4 && std::fgetc(file) == '\n' &&
+              std::string(magic) == "PF" && w == width && h == height && scale < 0;
+
+    std::vector<float> values(static_cast<size_t>(width) * height * 3);
+    ok = ok && std::fread(values.data(), sizeof(float), values.size(), file) == values.size();
+    std::fclose(file);
+    if (!ok)
+        return false;
+
+    pixels.resize(static_cast<size_t>(width) * height);
+    for (int row = 0; row < height; row++)
+    {
+        const float *in = &values[static_cast<size_t>(row) * width * 3];
+        Color *out = &pixels[static_cast<size_t>(height - 1 - row) * width];
+        for (int i = 0; i < width; i++)
+            out[i] = Color(in[3 * i], in[3 * i + 1], in[3 * i + 2]);
+    }
+    return true;
+}
+
+// Root mean square difference of two linear images after the gamma 2 and
+// clamping write_color applies, i.e. the error visible in the 8-bit output
+inline double rmse(const std::vector<Color> &a, const std::vector<Color> &b)
+{
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            double diff = std::sqrt(clamp(a[i][c], 0.0, 1.0)) - std::sqrt(clamp(b[i][c], 0.0, 1.0));
+            sum += diff * diff;
+        }
+    }
+    return std::sqrt(sum / (3.0 * a.size()));
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Commons.h"
+#include "Ray.h"
+#include "AABB.h"
+#include "Hittable.h"
+#include "BVH.h"
+#include "Transform.h"
+
+// One placement of shared geometry: a prototype index and an object-to-world
+// transform. Costs two matrices however large the prototype is.
+struct Instance
+{
+    Transform toWorld;
+    uint32_t prototype;
+
+    Instance() {}
+    Instance(uint32_t proto, const Transform &transform) : toWorld(transform), prototype(proto) {}
+};
+
+// Top level of a two-level acceleration structure. Prototypes are bottom-level
+// structures in their own object space, typically a BVH or a TriangleMesh,
+// and are shared by any number of instances. The top-level BVHTree is built
+// over the world-space bounds of the instances. Rays are moved into object
+// space at the instance boundary. The direction is not renormalised, so the
+// prototype reports distances along the world ray. Instances of an
+// InstanceSet are not supported, because a HitPoint holds one inner hit.
+class InstanceSet : public Hittable
+{
+private:
+    std::vector<shared_ptr<Hittable>> prototypes;
+    std::vector<Instance> instances; // In leaf order
+    BVHTree tree;
+
+public:
+    InstanceSet() {}
+    InstanceSet(std::vector<shared_ptr<Hittable>> protos, std::vector<Instance> placements)
+        : prototypes(std::move(protos)), instances(std::move(placements))
+    {
+        std::vector<AABB> prototypeBounds(prototypes.size());
+        for (size_t i = 0; i < prototypes.size(); i++)
+        {
+            if (!prototypes[i]->boundingBox(0, 0, prototypeBounds[i]))
+                std::cerr << "No bounding box in InstanceSet constructor.\n";
+        }
+
+        std::vector<AABB> bounds(instances.size());
+        for (size_t i = 0; i < instances.size(); i++)
+            bounds[i] = instances[i].toWorld.bounds(prototypeBounds[instances[i].prototype]);
+        tree.build(bounds);
+
+        std::vector<Instance> sorted;
+        sorted.reserve(instances.size());
+        for (uint32_t index : tree.primIndices)
+            sorted.push_back(instances[index]);
+        instances.swap(sorted);
+        tree.primIndices.clear();
+        tree.primIndices.shrink_to_fit();
+    }
+
+    size_t instanceCount() const { return instances.size(); }
+    size_t prototypeCount() const { return prototypes.size(); }
+
+    // Memory of the top level alone; the prototypes are counted once by their owners
+    size_t memoryBytes() const
+    {
+        return instances.capacity() * sizeof(Instance) + tree.nodes.capacity() * sizeof(BVHNode) +
+               prototypes.capacity() * sizeof(shared_ptr<Hittable>);
+    }
+
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual void fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const override;
+    virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override;
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override;
+};
+
+bool InstanceSet::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
+{
+    return tree.traverse(ray, t_min, t_max,
+                         [&](uint32_t first, uint32_t count, double &closest)
+                         {
+                             bool hitAnything = false;
+                             for (uint32_t i = first; i < first + count; i++)
+                             {
+                                 const Instance &instance = instances[i];
+                                 Ray local = instance.toWorld.inverseRay(ray);
+                                 HitPoint inner;
+                                 if (prototypes[instance.prototype]->intersect(local, t_min, closest, inner))
+                                 {
+                                     hitAnything = true;
+                                     closest = inner.t;
+                                     point.t = inner.t;
+                                     point.object = this;
+                                     point.index = i;
+                                     point.inner = inner.object;
+                                     point.innerIndex = inner.index;
+                                 }
+                             }
+                             return hitAnything;
+                         });
+}
+
+// The prototype fills the record in object space, then the point and normal
+// are moved to world space. Facing is unchanged by the move, since the normal
+// goes through the inverse transpose.
+void InstanceSet::fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const
+{
+    const Transform &toWorld = instances[point.index].toWorld;
+    HitPoint inner{point.t, point.inner, point.innerIndex, 0, nullptr};
+    point.inner->fillRecord(toWorld.inverseRay(ray), inner, rec);
+    rec.p = ray.at(point.t);
+    rec.normal = unit_vector(toWorld.normal(rec.normal));
+}
+
+bool InstanceSet::occluded(const Ray &ray, double t_min, double t_max) const
+{
+    return tree.traverseAny(ray, t_min, t_max,
+                            [&](uint32_t first, uint32_t count)
+                            {
+                                for (uint32_t i = first; i < first + count; i++)
+                                {
+                                    const Instance &instance = instances[i];
+                                    if (prototypes[instance.prototype]->occluded(instance.toWorld.inverseRay(ray), t_min, t_max))
+                                        return true;
+                                }
+                                return false;
+                            });
+}
+
+bool InstanceSet::boundingBox(double time0, double time1, AABB &OutBox) const
+{
+    if (tree.empty())
+        return false;
+    OutBox = tree.bounds();
+    return true;
+}
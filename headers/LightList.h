@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+#include "Commons.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "Material.h"
+#include "Sphere.h"
+#include "AARect.h"
+
+// Primitives with a light material, gathered once when the scene is built so
+// that diffuse bounces can sample them directly. Each sample picks a light
+// uniformly, so the density of a direction is the average over all lights.
+// Lights are assumed not to overlap as seen from a shading point.
+class LightList
+{
+public:
+    std::vector<shared_ptr<Hittable>> lights;
+
+public:
+    LightList() {}
+    LightList(const HittableList &scene)
+    {
+        for (const auto &object : scene.objects)
+        {
+            const Material *mat = lightMaterial(*object);
+            if (mat && mat->isLight())
+                lights.push_back(object);
+        }
+    }
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    const Hittable &pick() const
+    {
+        return *lights[random_int(0, static_cast<int>(lights.size()) - 1)];
+    }
+
+    double pdfValue(const Point3 &origin, const Vec3 &direction) const
+    {
+        double sum = 0;
+        for (const auto &light : lights)
+            sum += light->pdfValue(origin, direction);
+        return sum / lights.size();
+    }
+
+private:
+    // Material of the primitive types that implement light sampling
+    static const Material *lightMaterial(const Hittable &object)
+    {
+        if (auto sphere = dynamic_cast<const Sphere *>(&object))
+            return sphere->getMaterial().get();
+        if (auto rect = dynamic_cast<const XYRect *>(&object))
+            return rect->getMaterial().get();
+        if (auto rect = dynamic_cast<const XZRect *>(&object))
+            return rect->getMaterial().get();
+        if (auto rect = dynamic_cast<const YZRect *>(&object))
+            return rect->getMaterial().get();
+        return nullptr;
+    }
+};
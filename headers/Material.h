@@ -15,6 +15,14 @@ public:
     {
         return Color(0.01, 0.01, 0.01);
     }
+
+    // Non-specular materials get direct light sampling and must report the
+    // solid angle density with which scatter() picks `scattered`.
+    virtual bool isSpecular() const { return true; }
+    virtual double scatteringPdf(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const { return 0.0; }
+
+    // Emitters that are gathered into the LightList and sampled directly
+    virtual bool isLight() const { return false; }
 };
 
 class Lambertian : public Material
@@ -37,16 +45,25 @@ public:
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
+
+    virtual bool isSpecular() const override { return false; }
+
+    // Cosine weighted, like the directions scatter() produces
+    virtual double scatteringPdf(const Ray &ray_in, const HitRecord &rec, const Ray &scattered) const override
+    {
+        real cosine = dot(rec.normal, unit_vector(scattered.direction()));
+        return cosine < 0 ? 0 : cosine / pi;
+    }
 };
 
 class Metal : public Material
 {
 private:
     Color albedo;
-    double fuzz;
+    real fuzz;
 
 public:
-    Metal(const Color &a, double f) : albedo(a), fuzz(f) {}
+    Metal(const Color &a, real f) : albedo(a), fuzz(f) {}
     Metal(const Color &a) : albedo(a), fuzz(0) {}
 
     virtual bool scatter(const Ray &ray_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override
@@ -61,19 +78,19 @@ public:
 class Dielectric : public Material
 {
 private:
-    double ir;
+    real ir;
 
 public:
-    Dielectric(double _ir) : ir(_ir) {}
+    Dielectric(real _ir) : ir(_ir) {}
 
     virtual bool scatter(const Ray &ray_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override
     {
         attenuation = Color(1, 1, 1);
-        double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+        real refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
         Vec3 unit_direction = unit_vector(ray_in.direction());
-        double cos_th = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_th = sqrt(1.0 - cos_th * cos_th);
+        real cos_th = fmin(dot(-unit_direction, rec.normal), 1.0);
+        real sin_th = sqrt(1.0 - cos_th * cos_th);
 
         bool _refract = refraction_ratio * sin_th <= 1.0;
         Vec3 direction;
@@ -87,7 +104,7 @@ public:
     }
 
 private:
-    static double reflectance(double cos, double ref_idx)
+    static real reflectance(real cos, real ref_idx)
     {
         // Schlick's approximation
         auto r_0 = (1 - ref_idx) / (1 + ref_idx);
@@ -115,4 +132,6 @@ public:
     {
         return emit->value(u, v, p);
     }
+
+    virtual bool isLight() const override { return true; }
 };
\ No newline at end of file
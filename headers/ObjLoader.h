@@ -0,0 +1,155 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Vec3.h"
+
+// Streaming reader for the geometry of a Wavefront OBJ file. Only vertex
+// positions ("v") and faces ("f") are used: polygons are split into a fan of
+// triangles, and texture coordinates, normals, groups and materials are
+// skipped. The file is read in fixed-size blocks, so the loader needs no
+// more memory than the mesh it produces.
+class ObjReader
+{
+public:
+    std::vector<Point3> vertices;
+    std::vector<uint32_t> indices; // Three per triangle
+
+    bool read(const std::string &fileName, std::string &error)
+    {
+        std::FILE *file = std::fopen(fileName.c_str(), "rb");
+        if (!file)
+        {
+            error = "cannot open " + fileName;
+            return false;
+        }
+
+        std::vector<char> block(blockSize);
+        size_t filled = 0;
+        bool ok = true;
+        while (ok)
+        {
+            filled += std::fread(block.data() + filled, 1, block.size() - filled, file);
+            bool last = filled < block.size();
+
+            // Parse the complete lines; a partial last line waits for the next block
+            const char *begin = block.data();
+            const char *end = begin + filled;
+            const char *lineStart = begin;
+            while (ok)
+            {
+                const char *lineEnd = static_cast<const char *>(std::memchr(lineStart, '\n', end - lineStart));
+                if (!lineEnd)
+                {
+                    if (!last)
+                        break;
+                    lineEnd = end;
+                }
+                ok = parseLine(lineStart, lineEnd, error);
+                line++;
+                lineStart = lineEnd + 1;
+                if (lineEnd == end)
+                    break;
+            }
+
+            if (last || !ok)
+                break;
+            if (lineStart == begin)
+            {
+                error = "line " + std::to_string(line) + " is too long";
+                ok = false;
+                break;
+            }
+            filled = end - lineStart;
+            std::memmove(block.data(), lineStart, filled);
+        }
+        std::fclose(file);
+
+        for (size_t i = 0; ok && i < indices.size(); i++)
+        {
+            if (indices[i] >= vertices.size())
+            {
+                error = "face refers to missing vertex " + std::to_string(indices[i] + 1);
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+private:
+    static const size_t blockSize = 1 << 20;
+
+    size_t line = 1;
+    std::vector<uint32_t> face; // Vertex indices of the current polygon
+
+    bool parseLine(const char *p, const char *end, std::string &error)
+    {
+        p = skipBlank(p, end);
+        if (end - p < 2 || (p[1] != ' ' && p[1] != '\t'))
+            return true;
+
+        if (p[0] == 'v')
+        {
+            double xyz[3];
+            p++;
+            for (double &value : xyz)
+            {
+                p = skipBlank(p, end);
+                auto result = std::from_chars(p, end, value);
+                if (result.ec != std::errc())
+                    return fail("expected a vertex coordinate", error);
+                p = result.ptr;
+            }
+            vertices.emplace_back(xyz[0], xyz[1], xyz[2]);
+        }
+        else if (p[0] == 'f')
+        {
+            // Each corner is v, v/vt, v//vn or v/vt/vn; only v is used
+            face.clear();
+            p = skipBlank(p + 1, end);
+            while (p < end && *p != '#' && *p != '\r')
+            {
+                long index;
+                auto result = std::from_chars(p, end, index);
+                if (result.ec != std::errc() || index == 0)
+                    return fail("bad face index", error);
+                index = index < 0 ? static_cast<long>(vertices.size()) + index : index - 1;
+                if (index < 0)
+                    return fail("bad face index", error);
+                face.push_back(static_cast<uint32_t>(index));
+
+                p = result.ptr;
+                while (p < end && *p != ' ' && *p != '\t')
+                    p++;
+                p = skipBlank(p, end);
+            }
+            if (face.size() < 3)
+                return fail("face with fewer than three vertices", error);
+            for (size_t i = 2; i < face.size(); i++)
+            {
+                indices.push_back(face[0]);
+                indices.push_back(face[i - 1]);
+                indices.push_back(face[i]);
+            }
+        }
+        return true;
+    }
+
+    static const char *skipBlank(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        return p;
+    }
+
+    bool fail(const std::string &text, std::string &error) const
+    {
+        error = "line " + std::to_string(line) + ": " + text;
+        return false;
+    }
+};
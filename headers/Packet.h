@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Commons.h"
+#include "Vec3.h"
+#include "Ray.h"
+
+// Four doubles processed in lockstep: one AVX register, two SSE2 registers or
+// a plain array, depending on what the target supports. Comparisons return
+// lane masks (all bits set for true) in the same representation.
+struct Double4
+{
+#if defined(__AVX__)
+    __m256d v;
+
+    Double4() {}
+    Double4(__m256d _v) : v(_v) {}
+    Double4(double x) : v(_mm256_set1_pd(x)) {}
+
+    static Double4 load(const double *p) { return _mm256_load_pd(p); }
+    static Double4 load(const float *p) { return _mm256_cvtps_pd(_mm_load_ps(p)); }
+    void store(double *p) const { _mm256_store_pd(p, v); }
+
+    friend Double4 operator+(Double4 a, Double4 b) { return _mm256_add_pd(a.v, b.v); }
+    friend Double4 operator-(Double4 a, Double4 b) { return _mm256_sub_pd(a.v, b.v); }
+    friend Double4 operator*(Double4 a, Double4 b) { return _mm256_mul_pd(a.v, b.v); }
+    friend Double4 operator/(Double4 a, Double4 b) { return _mm256_div_pd(a.v, b.v); }
+    friend Double4 operator&(Double4 a, Double4 b) { return _mm256_and_pd(a.v, b.v); }
+    friend Double4 operator|(Double4 a, Double4 b) { return _mm256_or_pd(a.v, b.v); }
+    friend Double4 operator<(Double4 a, Double4 b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+    friend Double4 operator<=(Double4 a, Double4 b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+    friend Double4 operator>=(Double4 a, Double4 b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ); }
+
+    friend Double4 min(Double4 a, Double4 b) { return _mm256_min_pd(a.v, b.v); }
+    friend Double4 max(Double4 a, Double4 b) { return _mm256_max_pd(a.v, b.v); }
+    friend Double4 sqrt(Double4 a) { return _mm256_sqrt_pd(a.v); }
+    friend Double4 round_to_float(Double4 a) { return _mm256_cvtps_pd(_mm256_cvtpd_ps(a.v)); }
+    // mask ? a : b
+    friend Double4 select(Double4 mask, Double4 a, Double4 b) { return _mm256_blendv_pd(b.v, a.v, mask.v); }
+
+    int bits() const { return _mm256_movemask_pd(v); }
+#elif defined(__SSE2__)
+    __m128d lo, hi;
+
+    Double4() {}
+    Double4(__m128d _lo, __m128d _hi) : lo(_lo), hi(_hi) {}
+    Double4(double x) : lo(_mm_set1_pd(x)), hi(_mm_set1_pd(x)) {}
+
+    static Double4 load(const double *p) { return Double4(_mm_load_pd(p), _mm_load_pd(p + 2)); }
+    static Double4 load(const float *p)
+    {
+        __m128 f = _mm_load_ps(p);
+        return Double4(_mm_cvtps_pd(f), _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+    }
+    void store(double *p) const
+    {
+        _mm_store_pd(p, lo);
+        _mm_store_pd(p + 2, hi);
+    }
+
+    friend Double4 operator+(Double4 a, Double4 b) { return Double4(_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)); }
+    friend Double4 operator-(Double4 a, Double4 b) { return Double4(_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)); }
+    friend Double4 operator*(Double4 a, Double4 b) { return Double4(_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)); }
+    friend Double4 operator/(Double4 a, Double4 b) { return Double4(_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)); }
+    friend Double4 operator&(Double4 a, Double4 b) { return Double4(_mm_and_pd(a.lo, b.lo), _mm_and_pd(a.hi, b.hi)); }
+    friend Double4 operator|(Double4 a, Double4 b) { return Double4(_mm_or_pd(a.lo, b.lo), _mm_or_pd(a.hi, b.hi)); }
+    friend Double4 operator<(Double4 a, Double4 b) { return Double4(_mm_cmplt_pd(a.lo, b.lo), _mm_cmplt_pd(a.hi, b.hi)); }
+    friend Double4 operator<=(Double4 a, Double4 b) { return Double4(_mm_cmple_pd(a.lo, b.lo), _mm_cmple_pd(a.hi, b.hi)); }
+    friend Double4 operator>=(Double4 a, Double4 b) { return Double4(_mm_cmpge_pd(a.lo, b.lo), _mm_cmpge_pd(a.hi, b.hi)); }
+
+    friend Double4 min(Double4 a, Double4 b) { return Double4(_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)); }
+    friend Double4 max(Double4 a, Double4 b) { return Double4(_mm_max_pd(a.lo, b.lo), _mm_max_pd(a.hi, b.hi)); }
+    friend Double4 sqrt(Double4 a) { return Double4(_mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi)); }
+    friend Double4 round_to_float(Double4 a) { return Double4(_mm_cvtps_pd(_mm_cvtpd_ps(a.lo)), _mm_cvtps_pd(_mm_cvtpd_ps(a.hi))); }
+    friend Double4 select(Double4 mask, Double4 a, Double4 b)
+    {
+        return Double4(_mm_or_pd(_mm_and_pd(mask.lo, a.lo), _mm_andnot_pd(mask.lo, b.lo)),
+                       _mm_or_pd(_mm_and_pd(mask.hi, a.hi), _mm_andnot_pd(mask.hi, b.hi)));
+    }
+
+    int bits() const { return _mm_movemask_pd(lo) | (_mm_movemask_pd(hi) << 2); }
+#else
+    double e[4];
+
+    Double4() {}
+    Double4(double x) : e{x, x, x, x} {}
+
+    template <typename T>
+    static Double4 load(const T *p)
+    {
+        Double4 r;
+        for (int i = 0; i < 4; i++)
+            r.e[i] = p[i];
+        return r;
+    }
+    void store(double *p) const
+    {
+        for (int i = 0; i < 4; i++)
+            p[i] = e[i];
+    }
+
+    template <typename Op>
+    static Double4 map(Double4 a, Double4 b, Op op)
+    {
+        Double4 r;
+        for (int i = 0; i < 4; i++)
+            r.e[i] = op(a.e[i], b.e[i]);
+        return r;
+    }
+
+    static double maskOf(bool b)
+    {
+        uint64_t bits = b ? ~0ull : 0ull;
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    static bool isSet(double d)
+    {
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(d));
+        return bits >> 63;
+    }
+
+    static double andBits(double a, double b, bool useOr)
+    {
+        uint64_t x, y;
+        memcpy(&x, &a, sizeof(a));
+        memcpy(&y, &b, sizeof(b));
+        x = useOr ? (x | y) : (x & y);
+        memcpy(&a, &x, sizeof(a));
+        return a;
+    }
+
+    friend Double4 operator+(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return x + y; }); }
+    friend Double4 operator-(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return x - y; }); }
+    friend Double4 operator*(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return x * y; }); }
+    friend Double4 operator/(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return x / y; }); }
+    friend Double4 operator&(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return andBits(x, y, false); }); }
+    friend Double4 operator|(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return andBits(x, y, true); }); }
+    friend Double4 operator<(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return maskOf(x < y); }); }
+    friend Double4 operator<=(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return maskOf(x <= y); }); }
+    friend Double4 operator>=(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return maskOf(x >= y); }); }
+
+    friend Double4 min(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return y < x ? y : x; }); }
+    friend Double4 max(Double4 a, Double4 b) { return map(a, b, [](double x, double y) { return y > x ? y : x; }); }
+    friend Double4 sqrt(Double4 a) { return map(a, a, [](double x, double) { return std::sqrt(x); }); }
+    friend Double4 round_to_float(Double4 a) { return map(a, a, [](double x, double) { return static_cast<double>(static_cast<float>(x)); }); }
+    friend Double4 select(Double4 mask, Double4 a, Double4 b)
+    {
+        Double4 r;
+        for (int i = 0; i < 4; i++)
+            r.e[i] = isSet(mask.e[i]) ? a.e[i] : b.e[i];
+        return r;
+    }
+
+    int bits() const
+    {
+        int r = 0;
+        for (int i = 0; i < 4; i++)
+            r |= isSet(e[i]) << i;
+        return r;
+    }
+#endif
+};
+
+// Four lanes of `real` for the SIMD intersection kernels, which have to give
+// the same answers as the scalar primitives. In the double build this is
+// Double4. With RT_FLOAT every result is rounded to float; for + - * / and
+// sqrt, rounding the double result is exactly the float operation.
+// Comparisons and masks stay Double4.
+#ifdef RT_FLOAT
+struct Real4
+{
+    Double4 v;
+
+    Real4() {}
+    Real4(double x) : v(static_cast<float>(x)) {}
+    explicit Real4(Double4 x) : v(round_to_float(x)) {}
+    operator Double4() const { return v; }
+
+    void store(double *p) const { v.store(p); }
+
+    friend Real4 operator+(Real4 a, Real4 b) { return Real4(a.v + b.v); }
+    friend Real4 operator-(Real4 a, Real4 b) { return Real4(a.v - b.v); }
+    friend Real4 operator*(Real4 a, Real4 b) { return Real4(a.v * b.v); }
+    friend Real4 operator/(Real4 a, Real4 b) { return Real4(a.v / b.v); }
+    friend Real4 max(Real4 a, Real4 b) { return Real4(max(a.v, b.v)); }
+    friend Real4 sqrt(Real4 a) { return Real4(sqrt(a.v)); }
+};
+#else
+typedef Double4 Real4;
+#endif
+
+// Four rays traced together, stored both per lane (for shading) and as
+// structure-of-arrays (for the SIMD intersection kernels).
+struct RayPacket
+{
+    static const int size = 4;
+
+    Ray rays[size];
+    alignas(32) double origin[3][size];
+    alignas(32) double direction[3][size];
+    alignas(32) double invDirection[3][size];
+    int active = 0; // Bit i set when lane i carries a ray
+
+    void set(int lane, const Ray &ray)
+    {
+        rays[lane] = ray;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            origin[axis][lane] = ray.origin()[axis];
+            direction[axis][lane] = ray.direction()[axis];
+            invDirection[axis][lane] = 1.0 / ray.direction()[axis];
+        }
+        active |= 1 << lane;
+    }
+
+    // Fills unused lanes with a copy of an active ray so that every lane
+    // holds finite values; their results are masked out.
+    void pad()
+    {
+        int first = 0;
+        while (first < size && !(active >> first & 1))
+            first++;
+        if (first == size)
+            return;
+        for (int lane = 0; lane < size; lane++)
+        {
+            if (active >> lane & 1)
+                continue;
+            rays[lane] = rays[first];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                origin[axis][lane] = origin[axis][first];
+                direction[axis][lane] = direction[axis][first];
+                invDirection[axis][lane] = invDirection[axis][first];
+            }
+        }
+    }
+
+    Double4 o(int axis) const { return Double4::load(origin[axis]); }
+    Double4 d(int axis) const { return Double4::load(direction[axis]); }
+    Double4 invD(int axis) const { return Double4::load(invDirection[axis]); }
+};
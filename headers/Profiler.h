@@ -0,0 +1,261 @@
+#pragma once
+
+// Render instrumentation, compiled in with -DRT_PROFILE. It counts rays per
+// bounce depth, BVH nodes visited, primitive tests and scatter calls per
+// material type, times the main render phases, and can record a per-pixel
+// cost map. Counters live in a thread_local block that each thread folds
+// into a shared total when it exits, so workers never contend. Without the
+// flag every PROFILE_ macro expands to nothing.
+
+#ifdef RT_PROFILE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include <cxxabi.h>
+
+#include "Image.h"
+
+enum ProfilePhase
+{
+    PhaseRayColor,     // Whole paths: ray_color, or a packet or wavefront batch
+    PhaseIntersection, // Closest-hit and shadow queries against the world
+    PhaseMaterial,     // shade_hit: emission, scattering and light sampling
+    PhaseOutput,       // Image, heatmap and checkpoint writes
+    PhaseCount
+};
+
+struct ProfileCounters
+{
+    static const int depthBins = 32; // The last bin also holds deeper rays
+
+    uint64_t rays[depthBins] = {};
+    uint64_t shadowRays[depthBins] = {};
+    uint64_t nodesVisited = 0;
+    uint64_t primitiveTests = 0;
+    uint64_t phaseNanos[PhaseCount] = {};
+    uint64_t phaseCalls[PhaseCount] = {};
+    std::vector<std::pair<std::type_index, uint64_t>> scatterCalls;
+
+    // Traversal work, the quantity the heatmap shows
+    uint64_t cost() const { return nodesVisited + primitiveTests; }
+
+    void countScatter(const std::type_info &type)
+    {
+        for (auto &entry : scatterCalls)
+        {
+            if (entry.first == type)
+            {
+                entry.second++;
+                return;
+            }
+        }
+        scatterCalls.emplace_back(type, 1);
+    }
+
+    void merge(const ProfileCounters &other)
+    {
+        for (int d = 0; d < depthBins; d++)
+        {
+            rays[d] += other.rays[d];
+            shadowRays[d] += other.shadowRays[d];
+        }
+        nodesVisited += other.nodesVisited;
+        primitiveTests += other.primitiveTests;
+        for (int p = 0; p < PhaseCount; p++)
+        {
+            phaseNanos[p] += other.phaseNanos[p];
+            phaseCalls[p] += other.phaseCalls[p];
+        }
+        for (const auto &entry : other.scatterCalls)
+        {
+            auto it = std::find_if(scatterCalls.begin(), scatterCalls.end(),
+                                   [&](const std::pair<std::type_index, uint64_t> &e) { return e.first == entry.first; });
+            if (it == scatterCalls.end())
+                scatterCalls.push_back(entry);
+            else
+                it->second += entry.second;
+        }
+    }
+};
+
+// Counters of the threads that have already exited
+inline std::mutex &profile_lock()
+{
+    static std::mutex lock;
+    return lock;
+}
+
+inline ProfileCounters &profile_finished()
+{
+    static ProfileCounters finished;
+    return finished;
+}
+
+struct ThreadProfile
+{
+    ProfileCounters counters;
+
+    ~ThreadProfile()
+    {
+        std::lock_guard<std::mutex> guard(profile_lock());
+        profile_finished().merge(counters);
+    }
+};
+
+inline ProfileCounters &profile_counters()
+{
+    thread_local ThreadProfile profile;
+    return profile.counters;
+}
+
+// Everything counted so far by exited threads and the calling thread
+inline ProfileCounters profile_total()
+{
+    std::lock_guard<std::mutex> guard(profile_lock());
+    ProfileCounters total = profile_finished();
+    total.merge(profile_counters());
+    return total;
+}
+
+// Traversal cost summed per pixel; empty unless a heatmap was requested
+inline std::vector<double> &profile_heatmap()
+{
+    static std::vector<double> heatmap;
+    return heatmap;
+}
+
+inline uint64_t profile_cost()
+{
+    return profile_counters().cost();
+}
+
+// Each pixel is rendered by one thread at a time, so no lock is needed
+inline void profile_pixel_cost(size_t pixel, double cost)
+{
+    std::vector<double> &heatmap = profile_heatmap();
+    if (!heatmap.empty())
+        heatmap[pixel] += cost;
+}
+
+// Adds the time from construction to destruction to one phase
+class ProfileScope
+{
+private:
+    ProfilePhase phase;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit ProfileScope(ProfilePhase p) : phase(p), start(std::chrono::steady_clock::now()) {}
+    ~ProfileScope()
+    {
+        ProfileCounters &counters = profile_counters();
+        counters.phaseNanos[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        counters.phaseCalls[phase]++;
+    }
+};
+
+inline std::string profile_type_name(const std::type_index &type)
+{
+    int status = 0;
+    char *name = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    std::string result = status == 0 && name ? name : type.name();
+    std::free(name);
+    return result;
+}
+
+inline void print_profile(std::ostream &out)
+{
+    ProfileCounters total = profile_total();
+    uint64_t rays = 0;
+    for (int d = 0; d < ProfileCounters::depthBins; d++)
+        rays += total.rays[d] + total.shadowRays[d];
+
+    out << "Profile:\n  Rays by depth (closest hit / shadow):";
+    for (int d = 0; d < ProfileCounters::depthBins; d++)
+    {
+        if (total.rays[d] || total.shadowRays[d])
+            out << "\n    " << d << (d == ProfileCounters::depthBins - 1 ? "+" : "") << ": " << total.rays[d] << " / " << total.shadowRays[d];
+    }
+    if (rays > 0)
+    {
+        out << "\n  BVH nodes visited per ray: " << static_cast<double>(total.nodesVisited) / rays
+            << "\n  Primitive tests per ray: " << static_cast<double>(total.primitiveTests) / rays;
+    }
+    out << "\n  Scatter calls:";
+    for (const auto &entry : total.scatterCalls)
+        out << "\n    " << profile_type_name(entry.first) << ": " << entry.second;
+
+    // Phases nest: intersection and material time are part of ray_color
+    static const char *names[PhaseCount] = {"ray_color", "intersection", "material", "output"};
+    out << "\n  Thread time:";
+    for (int p = 0; p < PhaseCount; p++)
+    {
+        double seconds = total.phaseNanos[p] * 1e-9;
+        out << "\n    " << std::left << std::setw(13) << names[p] << std::right << seconds << " s in " << total.phaseCalls[p] << " calls";
+        if (p != PhaseRayColor && p != PhaseOutput && total.phaseNanos[PhaseRayColor] > 0)
+            out << " (" << 100.0 * total.phaseNanos[p] / total.phaseNanos[PhaseRayColor] << "% of ray_color)";
+    }
+    out << "\n";
+}
+
+// Writes the heatmap as cost per sample through a black-red-yellow-white
+// ramp. The scale tops out at the 99th percentile so a few very expensive
+// pixels do not flatten the rest.
+inline bool write_heatmap(const std::string &fileName, int width, int height, const std::vector<uint32_t> &samples, double &scaleMax)
+{
+    const std::vector<double> &heatmap = profile_heatmap();
+    std::vector<double> perSample(heatmap.size(), 0.0);
+    for (size_t i = 0; i < heatmap.size(); i++)
+        perSample[i] = samples[i] ? heatmap[i] / samples[i] : 0.0;
+
+    std::vector<double> sorted = perSample;
+    size_t rank = sorted.empty() ? 0 : (sorted.size() - 1) * 99 / 100;
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    scaleMax = sorted.empty() ? 0.0 : std::max(sorted[rank], 1.0);
+
+    std::vector<unsigned char> body(perSample.size() * 3);
+    for (size_t i = 0; i < perSample.size(); i++)
+    {
+        double x = std::min(perSample[i] / scaleMax, 1.0) * 3.0;
+        body[3 * i] = static_cast<unsigned char>(255.999 * std::min(x, 1.0));
+        body[3 * i + 1] = static_cast<unsigned char>(255.999 * std::clamp(x - 1.0, 0.0, 1.0));
+        body[3 * i + 2] = static_cast<unsigned char>(255.999 * std::clamp(x - 2.0, 0.0, 1.0));
+    }
+
+    std::string header = "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+    return write_buffer(fileName, header, body);
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(phase)
+#define PROFILE_COUNT(counter, n) (profile_counters().counter += (n))
+#define PROFILE_RAY(depth) (profile_counters().rays[std::min(depth, ProfileCounters::depthBins - 1)]++)
+#define PROFILE_SHADOW_RAY(depth) (profile_counters().shadowRays[std::min(depth, ProfileCounters::depthBins - 1)]++)
+#define PROFILE_SCATTER(material) profile_counters().countScatter(typeid(material))
+#define PROFILE_MARK(name) const uint64_t name = profile_cost()
+#define PROFILE_PIXEL_COST(pixel, cost) profile_pixel_cost(pixel, cost)
+
+#else
+
+#define PROFILE_SCOPE(phase)
+#define PROFILE_COUNT(counter, n)
+#define PROFILE_RAY(depth)
+#define PROFILE_SHADOW_RAY(depth)
+#define PROFILE_SCATTER(material)
+#define PROFILE_MARK(name)
+#define PROFILE_PIXEL_COST(pixel, cost)
+
+#endif
@@ -16,7 +16,7 @@ public:
     Point3 origin() const { return orig; }
     Vec3 direction() const { return dir; }
 
-    Point3 at(double t) const
+    Point3 at(real t) const
     {
         return orig + t * dir;
     }
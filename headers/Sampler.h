@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+// PCG32 (XSH-RR variant, see pcg-random.org): a 64-bit LCG whose output is
+// permuted down to 32 bits. Cheap to seed, so it can be reseeded per sample.
+class Pcg32
+{
+private:
+    uint64_t state;
+    uint64_t inc;
+
+public:
+    Pcg32() : Pcg32(0x853c49e6748fea9bull, 0xda3e39cb94b95bdbull) {}
+    Pcg32(uint64_t initState, uint64_t stream) { seed(initState, stream); }
+
+    void seed(uint64_t initState, uint64_t stream)
+    {
+        state = 0;
+        inc = (stream << 1) | 1;
+        next();
+        state += initState;
+        next();
+    }
+
+    uint32_t next()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1) & 31));
+    }
+
+    // Uniform in [0, 1)
+    double nextDouble()
+    {
+        return next() * (1.0 / 4294967296.0);
+    }
+};
+
+// Mixes a seed with an index (splitmix64 finaliser) so that neighbouring
+// indices produce unrelated generator states.
+inline uint64_t mix_seed(uint64_t seed, uint64_t index)
+{
+    uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Each thread owns its generator, so render workers neither race on nor
+// serialise through shared state.
+inline Pcg32 &thread_sampler()
+{
+    thread_local Pcg32 rng;
+    return rng;
+}
+
+// Positions the calling thread's generator at the start of one sample of one
+// pixel. The stream depends only on (seed, pixel, sample), so images are
+// reproducible whatever the thread count or tile order.
+inline void begin_sample(uint64_t seed, uint64_t pixel, uint32_t sample)
+{
+    thread_sampler().seed(mix_seed(seed, sample), pixel);
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+using std::shared_ptr;
+
+// Pool allocator for the objects of one scene: primitives, materials,
+// textures and nested structures such as meshes. Objects of one type are
+// placed back to back in chunks that grow geometrically up to chunkBytes,
+// so a million spheres take a few dozen allocations instead of a million
+// heap blocks with a shared_ptr control block each. Everything is destroyed
+// together with the arena.
+//
+// make() returns shared_ptrs that all share one control block, which counts
+// the pointers into the arena but does not own the objects. They stay valid
+// exactly as long as the arena, so every holder of one, such as a BVH built
+// over a list, must be destroyed before the arena. A HittableList keeps its
+// arena alive and releases its objects before it. The arena checks the rule
+// when it is destroyed: once its own objects have released their pointers
+// to each other, any pointer still counted would dangle, and it aborts.
+// Not thread-safe.
+class SceneArena
+{
+public:
+    static const size_t chunkBytes = 1 << 20;
+
+    SceneArena() : lifetime(static_cast<void *>(this), [](void *) {}) {}
+    SceneArena(const SceneArena &) = delete;
+    SceneArena &operator=(const SceneArena &) = delete;
+
+    ~SceneArena()
+    {
+        while (!pools.empty())
+            pools.pop_back();
+
+        long outstanding = lifetime.use_count() - 1;
+        if (outstanding > 0)
+        {
+            std::cerr << "SceneArena destroyed while " << outstanding << " pointers into it are alive\n";
+            std::abort();
+        }
+    }
+
+    template <typename T, typename... Args>
+    shared_ptr<T> make(Args &&...args)
+    {
+        Pool<T> &typed = pool<T>();
+        T *object = new (typed.slot()) T(std::forward<Args>(args)...);
+        typed.commit();
+        return shared_ptr<T>(lifetime, object);
+    }
+
+    size_t objectCount() const
+    {
+        size_t count = 0;
+        for (const auto &entry : pools)
+            count += entry.second->objects;
+        return count;
+    }
+
+    // Bytes taken by live objects, and bytes allocated for them
+    size_t bytesUsed() const
+    {
+        size_t bytes = 0;
+        for (const auto &entry : pools)
+            bytes += entry.second->objects * entry.second->objectSize;
+        return bytes;
+    }
+
+    size_t bytesReserved() const
+    {
+        size_t bytes = 0;
+        for (const auto &entry : pools)
+            bytes += entry.second->capacity * entry.second->objectSize;
+        return bytes;
+    }
+
+    size_t chunkCount() const
+    {
+        size_t count = 0;
+        for (const auto &entry : pools)
+            count += entry.second->chunks;
+        return count;
+    }
+
+private:
+    struct PoolBase
+    {
+        size_t objectSize;
+        size_t objects = 0;
+        size_t capacity = 0;
+        size_t chunks = 0;
+
+        explicit PoolBase(size_t size) : objectSize(size) {}
+        virtual ~PoolBase() {}
+    };
+
+    template <typename T>
+    struct Pool : PoolBase
+    {
+        struct Chunk
+        {
+            T *data;
+            size_t capacity;
+            size_t count;
+        };
+        std::vector<Chunk> storage;
+
+        Pool() : PoolBase(sizeof(T)) {}
+
+        ~Pool()
+        {
+            for (auto chunk = storage.rbegin(); chunk != storage.rend(); ++chunk)
+            {
+                for (size_t i = chunk->count; i > 0; i--)
+                    chunk->data[i - 1].~T();
+                ::operator delete(chunk->data, std::align_val_t(alignof(T)));
+            }
+        }
+
+        // Uninitialised storage for the next object; commit() once it is built
+        void *slot()
+        {
+            if (storage.empty() || storage.back().count == storage.back().capacity)
+            {
+                size_t limit = std::max<size_t>(chunkBytes / sizeof(T), 1);
+                size_t size = storage.empty() ? std::min<size_t>(64, limit) : std::min(2 * storage.back().capacity, limit);
+                T *data = static_cast<T *>(::operator new(size * sizeof(T), std::align_val_t(alignof(T))));
+                storage.push_back({data, size, 0});
+                capacity += size;
+                chunks++;
+            }
+            return storage.back().data + storage.back().count;
+        }
+
+        void commit()
+        {
+            storage.back().count++;
+            objects++;
+        }
+    };
+
+    template <typename T>
+    Pool<T> &pool()
+    {
+        const std::type_index type(typeid(T));
+        for (auto &entry : pools)
+            if (entry.first == type)
+                return static_cast<Pool<T> &>(*entry.second);
+        pools.emplace_back(type, std::unique_ptr<PoolBase>(new Pool<T>()));
+        return static_cast<Pool<T> &>(*pools.back().second);
+    }
+
+    std::vector<std::pair<std::type_index, std::unique_ptr<PoolBase>>> pools;
+    shared_ptr<void> lifetime; // Counts the pointers make() has handed out
+};
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Commons.h"
+#include "BVH.h"
+#include "FlatScene.h"
+#include "SceneLoader.h"
+
+static_assert(sizeof(BVHNode) == 32, "the scene cache stores BVHNode as 32 bytes");
+
+// Read-only memory mapping of a whole file, unmapped when destroyed.
+class MappedFile
+{
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile()
+    {
+        if (data)
+            munmap(const_cast<char *>(data), bytes);
+    }
+
+    bool open(const std::string &fileName)
+    {
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void *mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                data = static_cast<const char *>(mapped);
+                bytes = static_cast<size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+        return data != nullptr;
+    }
+
+    const char *data = nullptr;
+    size_t bytes = 0;
+};
+
+// Binary cache of a scene file: the FlatScene arrays and BVH nodes exactly as
+// they sit in memory, each section 64-byte aligned, so a render maps the file
+// and traces from it without deserialising anything. The material table is
+// kept as the scene file's own texture and material directives plus the name
+// of each table entry, and is rebuilt by the scene parser on load. The cache
+// records the size and modification time of its scene file and is ignored
+// once that changes. Only the machine that wrote a cache should read it.
+class SceneCache
+{
+public:
+    // Writes the cache for a scene loaded from `sourceName` and flattened into `flat`.
+    static bool save(const std::string &cacheName, const std::string &sourceName,
+                     const FlatScene &flat, const SceneDescription &description)
+    {
+        if (flat.hasOthers())
+            return false;
+
+        Header header{};
+        std::memcpy(header.magic, "RTSCENE", sizeof(header.magic));
+        header.version = version;
+        if (!sourceStamp(sourceName, header.sourceSize, header.sourceTime))
+            return false;
+
+        const CameraSettings &view = description.camera;
+        const double camera[10] = {view.vfov, view.lookfrom.x(), view.lookfrom.y(), view.lookfrom.z(),
+                                   view.lookat.x(), view.lookat.y(), view.lookat.z(), view.vup.x(), view.vup.y(), view.vup.z()};
+        std::memcpy(header.camera, camera, sizeof(camera));
+        header.hasBackground = description.hasBackground;
+        for (int i = 0; i < 3; i++)
+            header.background[i] = description.background[i];
+
+        // Name of each material table entry, one per line
+        std::string names;
+        for (const auto &mat : flat.materialList())
+        {
+            auto named = std::find_if(description.materials.begin(), description.materials.end(),
+                                      [&](const auto &entry)
+                                      { return entry.second == mat; });
+            if (named == description.materials.end())
+                return false;
+            names += named->first + "\n";
+        }
+
+        const FlatSceneView &arrays = flat.arrays();
+        header.sphereCount = arrays.sphereCount;
+        header.rectCount = arrays.rectCount;
+        header.sphereNodeCount = arrays.sphereNodeCount;
+        header.rectNodeCount = arrays.rectNodeCount;
+        header.materialCount = flat.materialList().size();
+
+        const void *data[SectionCount] = {
+            arrays.cx, arrays.cy, arrays.cz, arrays.radius, arrays.sphereMaterial,
+            arrays.k, arrays.a0, arrays.a1, arrays.b0, arrays.b1, arrays.axis, arrays.rectMaterial,
+            arrays.sphereNodes, arrays.rectNodes,
+            description.definitions.data(), names.data()};
+        const uint64_t bytes[SectionCount] = {
+            8 * header.sphereCount, 8 * header.sphereCount, 8 * header.sphereCount, 8 * header.sphereCount, 4 * header.sphereCount,
+            8 * header.rectCount, 8 * header.rectCount, 8 * header.rectCount, 8 * header.rectCount, 8 * header.rectCount,
+            header.rectCount, 4 * header.rectCount,
+            sizeof(BVHNode) * header.sphereNodeCount, sizeof(BVHNode) * header.rectNodeCount,
+            description.definitions.size(), names.size()};
+
+        uint64_t position = (sizeof(Header) + alignment - 1) / alignment * alignment;
+        for (int i = 0; i < SectionCount; i++)
+        {
+            header.offset[i] = position;
+            header.bytes[i] = bytes[i];
+            position += (bytes[i] + alignment - 1) / alignment * alignment;
+        }
+
+        std::string temporary = cacheName + ".tmp";
+        std::FILE *file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return false;
+
+        static const char padding[alignment] = {};
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        uint64_t written = sizeof(header);
+        for (int i = 0; ok && i < SectionCount; i++)
+        {
+            // Empty sections may have a null data pointer, which fwrite must not see
+            ok = std::fwrite(padding, 1, header.offset[i] - written, file) == header.offset[i] - written &&
+                 (bytes[i] == 0 || std::fwrite(data[i], 1, bytes[i], file) == bytes[i]);
+            written = header.offset[i] + bytes[i];
+        }
+        ok = ok && std::fwrite(padding, 1, position - written, file) == position - written;
+        ok = std::fclose(file) == 0 && ok;
+
+        return ok && std::rename(temporary.c_str(), cacheName.c_str()) == 0;
+    }
+
+    // Maps a cache written for `sourceName` and returns a FlatScene tracing from
+    // it, with the camera and background in `description`. Fails on a missing,
+    // malformed or stale cache, with the reason in `error`.
+    static bool load(const std::string &cacheName, const std::string &sourceName,
+                     shared_ptr<FlatScene> &scene, SceneDescription &description, std::string &error)
+    {
+        auto file = make_shared<MappedFile>();
+        if (!file->open(cacheName))
+        {
+            error = "cannot map " + cacheName;
+            return false;
+        }
+
+        Header header;
+        if (file->bytes < sizeof(header))
+        {
+            error = "truncated cache";
+            return false;
+        }
+        std::memcpy(&header, file->data, sizeof(header));
+        if (std::memcmp(header.magic, "RTSCENE", sizeof(header.magic)) != 0 || header.version != version)
+        {
+            error = "not a scene cache of version " + std::to_string(version);
+            return false;
+        }
+
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (!sourceStamp(sourceName, sourceSize, sourceTime) || sourceSize != header.sourceSize || sourceTime != header.sourceTime)
+        {
+            error = "cache is out of date";
+            return false;
+        }
+
+        const uint64_t expected[SectionCount] = {
+            8 * header.sphereCount, 8 * header.sphereCount, 8 * header.sphereCount, 8 * header.sphereCount, 4 * header.sphereCount,
+            8 * header.rectCount, 8 * header.rectCount, 8 * header.rectCount, 8 * header.rectCount, 8 * header.rectCount,
+            header.rectCount, 4 * header.rectCount,
+            sizeof(BVHNode) * header.sphereNodeCount, sizeof(BVHNode) * header.rectNodeCount,
+            header.bytes[Definitions], header.bytes[MaterialNames]};
+        for (int i = 0; i < SectionCount; i++)
+        {
+            if (header.bytes[i] != expected[i] || header.offset[i] % alignment != 0 ||
+                header.offset[i] > file->bytes || header.bytes[i] > file->bytes - header.offset[i])
+            {
+                error = "malformed cache";
+                return false;
+            }
+        }
+
+        auto section = [&](Section s)
+        { return file->data + header.offset[s]; };
+
+        FlatSceneView arrays;
+        arrays.cx = reinterpret_cast<const double *>(section(CX));
+        arrays.cy = reinterpret_cast<const double *>(section(CY));
+        arrays.cz = reinterpret_cast<const double *>(section(CZ));
+        arrays.radius = reinterpret_cast<const double *>(section(Radius));
+        arrays.sphereMaterial = reinterpret_cast<const uint32_t *>(section(SphereMaterial));
+        arrays.sphereCount = header.sphereCount;
+        arrays.k = reinterpret_cast<const double *>(section(K));
+        arrays.a0 = reinterpret_cast<const double *>(section(A0));
+        arrays.a1 = reinterpret_cast<const double *>(section(A1));
+        arrays.b0 = reinterpret_cast<const double *>(section(B0));
+        arrays.b1 = reinterpret_cast<const double *>(section(B1));
+        arrays.axis = reinterpret_cast<const uint8_t *>(section(Axis));
+        arrays.rectMaterial = reinterpret_cast<const uint32_t *>(section(RectMaterial));
+        arrays.rectCount = header.rectCount;
+        arrays.sphereNodes = reinterpret_cast<const BVHNode *>(section(SphereNodes));
+        arrays.sphereNodeCount = header.sphereNodeCount;
+        arrays.rectNodes = reinterpret_cast<const BVHNode *>(section(RectNodes));
+        arrays.rectNodeCount = header.rectNodeCount;
+
+        // Indices a corrupt file could use to read out of bounds. This touches
+        // the node and material pages but none of the geometry.
+        auto nodesValid = [](const BVHNode *nodes, uint64_t nodeCount, uint64_t primCount)
+        {
+            for (uint64_t i = 0; i < nodeCount; i++)
+            {
+                const BVHNode &node = nodes[i];
+                if (node.isLeaf() ? node.offset + static_cast<uint64_t>(node.count) > primCount
+                                  : i + 1 >= nodeCount || node.offset <= i || node.offset >= nodeCount)
+                    return false;
+            }
+            return true;
+        };
+        bool valid = nodesValid(arrays.sphereNodes, arrays.sphereNodeCount, arrays.sphereCount) &&
+                     nodesValid(arrays.rectNodes, arrays.rectNodeCount, arrays.rectCount);
+        for (uint64_t i = 0; valid && i < arrays.sphereCount; i++)
+            valid = arrays.sphereMaterial[i] < header.materialCount;
+        for (uint64_t i = 0; valid && i < arrays.rectCount; i++)
+            valid = arrays.rectMaterial[i] < header.materialCount && arrays.axis[i] < 3;
+        if (!valid)
+        {
+            error = "malformed cache";
+            return false;
+        }
+
+        // Rebuild the material table from the stored directives
+        const char *definitions = section(Definitions);
+        SceneParser parser(definitions, definitions + header.bytes[Definitions]);
+        if (!parser.parse(description))
+        {
+            error = "bad material definitions: " + parser.error();
+            return false;
+        }
+
+        std::vector<shared_ptr<Material>> materials;
+        const char *name = section(MaterialNames);
+        const char *namesEnd = name + header.bytes[MaterialNames];
+        while (name < namesEnd)
+        {
+            const char *lineEnd = static_cast<const char *>(std::memchr(name, '\n', namesEnd - name));
+            if (!lineEnd)
+                lineEnd = namesEnd;
+            auto found = description.materials.find(std::string(name, lineEnd));
+            if (found == description.materials.end())
+            {
+                error = "unknown material in cache";
+                return false;
+            }
+            materials.push_back(found->second);
+            name = lineEnd + 1;
+        }
+        if (materials.size() != header.materialCount)
+        {
+            error = "malformed cache";
+            return false;
+        }
+
+        description.camera.vfov = header.camera[0];
+        description.camera.lookfrom = Point3(header.camera[1], header.camera[2], header.camera[3]);
+        description.camera.lookat = Point3(header.camera[4], header.camera[5], header.camera[6]);
+        description.camera.vup = Vec3(header.camera[7], header.camera[8], header.camera[9]);
+        description.hasBackground = header.hasBackground != 0;
+        description.background = Color(header.background[0], header.background[1], header.background[2]);
+
+        scene = make_shared<FlatScene>(arrays, std::move(materials), file);
+        return true;
+    }
+
+private:
+    enum Section
+    {
+        CX, CY, CZ, Radius, SphereMaterial,
+        K, A0, A1, B0, B1, Axis, RectMaterial,
+        SphereNodes, RectNodes,
+        Definitions, MaterialNames,
+        SectionCount
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t hasBackground;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        double camera[10]; // vfov, lookfrom, lookat, vup
+        double background[3];
+        uint64_t sphereCount, rectCount, sphereNodeCount, rectNodeCount, materialCount;
+        uint64_t offset[SectionCount];
+        uint64_t bytes[SectionCount];
+    };
+
+    static const uint32_t version = 1;
+    static const uint64_t alignment = 64;
+
+    // Size and modification time of the scene file. The time is only
+    // compared for equality, so its clock and unit do not matter.
+    static bool sourceStamp(const std::string &sourceName, uint64_t &size, int64_t &time)
+    {
+        std::error_code error;
+        uintmax_t fileSize = std::filesystem::file_size(sourceName, error);
+        if (error)
+            return false;
+        auto written = std::filesystem::last_write_time(sourceName, error);
+        if (error)
+            return false;
+        size = static_cast<uint64_t>(fileSize);
+        time = static_cast<int64_t>(written.time_since_epoch().count());
+        return true;
+    }
+};
@@ -0,0 +1,483 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Commons.h"
+#include "Vec3.h"
+#include "HittableList.h"
+#include "Sphere.h"
+#include "AARect.h"
+#include "Material.h"
+#include "Texture.h"
+#include "TriangleMesh.h"
+#include "ObjLoader.h"
+#include "BVH.h"
+#include "Instance.h"
+
+// Text scene format, one directive per line, '#' starting a comment:
+//
+//   camera <vfov> [<from x y z> <at x y z> <up x y z>]
+//   background <r g b>
+//   texture <name> solid <r g b>
+//   texture <name> checker <scale> <even texture> <odd texture>
+//   material <name> lambertian <r g b | texture>
+//   material <name> metal <r g b> <fuzz>
+//   material <name> dielectric <index of refraction>
+//   material <name> light <r g b | texture>
+//   sphere <x y z> <radius> <material>
+//   xyrect <x0 x1 y0 y1 z> <material>
+//   xzrect <x0 x1 z0 z1 y> <material>
+//   yzrect <y0 y1 z0 z1 x> <material>
+//   mesh <OBJ file> <material>
+//   group <name>
+//   end
+//   instance <group> [translate <x y z>] [rotate <axis x y z> <degrees>] [scale <x y z>]...
+//
+// Textures and materials are named, must be defined before they are used and
+// are shared by every primitive that names them. Mesh paths are relative to
+// the scene file. Primitives between group and end form shared geometry that
+// is only rendered through instances, each applying its transforms from left
+// to right. Lights inside a group are not sampled directly. A number written
+// as <n>-offset or <n>+offset lies surface_offset below or above n, close
+// enough to sit just in front of a surface at n without coinciding with it in
+// either precision.
+
+// Camera placement; the defaults are the view used by the built-in scenes
+struct CameraSettings
+{
+    Point3 lookfrom = Point3(0, 0, 0);
+    Point3 lookat = Point3(0, 0, -1);
+    Vec3 vup = Vec3(0, 1, 0);
+    double vfov = 100;
+};
+
+struct SceneDescription
+{
+    HittableList world;
+    CameraSettings camera;
+    bool hasBackground = false;
+    Color background = Color(0, 0, 0);
+    std::unordered_map<std::string, shared_ptr<Material>> materials;
+    size_t textureCount = 0;
+    std::string definitions; // The texture and material directives, one per line
+};
+
+// Single-pass parser over a buffer holding the whole file. Numbers are read
+// in place with from_chars, and name lookups reuse one key string, so the only
+// allocation per primitive is its slot in the world's SceneArena, also for
+// primitives inside groups. Named textures and materials stay on the heap:
+// there are few of them, and SceneDescription::materials hands them out to
+// structures that do not keep the world alive, like a cached FlatScene.
+class SceneParser
+{
+public:
+    SceneParser(const char *begin, const char *end, const std::string &directory = "")
+        : p(begin), end(end), directory(directory) {}
+
+    bool parse(SceneDescription &scene)
+    {
+        if (!scene.world.arena)
+            scene.world.arena = make_shared<SceneArena>();
+
+        // Roughly one primitive per line
+        scene.world.objects.reserve(scene.world.objects.size() + std::count(p, end, '\n') + 1);
+
+        while (p < end)
+        {
+            std::string_view keyword = word();
+            if (!keyword.empty() && !directive(keyword, scene))
+                return false;
+            if (keyword == "texture" || keyword == "material")
+                scene.definitions.append(keyword.data(), p - keyword.data()).push_back('\n');
+            if (!atLineEnd())
+                return fail("unexpected text after " + std::string(keyword));
+            if (p < end)
+                p++;
+            line++;
+        }
+
+        if (inGroup)
+            return fail("group " + groupName + " is not closed");
+        if (!instances.empty())
+            scene.world.add(scene.world.make<InstanceSet>(prototypes, std::move(instances)));
+
+        scene.materials = materials;
+        scene.textureCount = textures.size();
+        return true;
+    }
+
+    const std::string &error() const { return message; }
+
+private:
+    bool directive(std::string_view keyword, SceneDescription &scene)
+    {
+        if (keyword == "sphere")
+        {
+            Point3 center;
+            double radius;
+            shared_ptr<Material> material;
+            if (!vector3(center) || !number(radius) || !materialName(material))
+                return false;
+            target(scene).add(scene.world.make<Sphere>(center, radius, material));
+        }
+        else if (keyword == "xyrect" || keyword == "xzrect" || keyword == "yzrect")
+        {
+            double a0, a1, b0, b1, k;
+            shared_ptr<Material> material;
+            if (!number(a0) || !number(a1) || !number(b0) || !number(b1) || !number(k) || !materialName(material))
+                return false;
+            if (keyword == "xyrect")
+                target(scene).add(scene.world.make<XYRect>(a0, a1, b0, b1, k, material));
+            else if (keyword == "xzrect")
+                target(scene).add(scene.world.make<XZRect>(a0, a1, b0, b1, k, material));
+            else
+                target(scene).add(scene.world.make<YZRect>(a0, a1, b0, b1, k, material));
+        }
+        else if (keyword == "mesh")
+        {
+            std::string path(word());
+            shared_ptr<Material> material;
+            if (path.empty())
+                return fail("mesh needs an OBJ file");
+            if (!materialName(material))
+                return false;
+
+            ObjReader reader;
+            std::string error;
+            if (!reader.read(path[0] == '/' ? path : directory + path, error))
+                return fail(path + ": " + error);
+            target(scene).add(scene.world.make<TriangleMesh>(std::move(reader.vertices), std::move(reader.indices), material));
+        }
+        else if (keyword == "group")
+        {
+            if (inGroup)
+                return fail("groups cannot be nested");
+            groupName = std::string(word());
+            if (groupName.empty())
+                return fail("group needs a name");
+            if (groups.count(groupName))
+                return fail("group " + groupName + " is defined twice");
+            inGroup = true;
+        }
+        else if (keyword == "end")
+            return endGroup();
+        else if (keyword == "instance")
+            return instance();
+        else if (keyword == "material")
+            return material();
+        else if (keyword == "texture")
+            return texture();
+        else if (keyword == "camera")
+        {
+            if (!number(scene.camera.vfov))
+                return false;
+            if (!atLineEnd() &&
+                (!vector3(scene.camera.lookfrom) || !vector3(scene.camera.lookat) || !vector3(scene.camera.vup)))
+                return false;
+        }
+        else if (keyword == "background")
+        {
+            scene.hasBackground = true;
+            return vector3(scene.background);
+        }
+        else
+            return fail("unknown directive " + std::string(keyword));
+        return true;
+    }
+
+    // A group of one primitive is used as it is, larger groups get a BVH
+    bool endGroup()
+    {
+        if (!inGroup)
+            return fail("end without group");
+        if (group.objects.empty())
+            return fail("group " + groupName + " is empty");
+
+        groups.emplace(groupName, static_cast<uint32_t>(prototypes.size()));
+        if (group.objects.size() == 1)
+            prototypes.push_back(group.objects[0]);
+        else
+            prototypes.push_back(make_shared<BVH>(group));
+        group.clear();
+        inGroup = false;
+        return true;
+    }
+
+    bool instance()
+    {
+        key.assign(word());
+        auto found = groups.find(key);
+        if (found == groups.end())
+            return fail("undefined group " + key);
+
+        Transform toWorld;
+        while (!atLineEnd())
+        {
+            std::string_view operation = word();
+            Vec3 v;
+            if (operation == "translate")
+            {
+                if (!vector3(v))
+                    return false;
+                toWorld = Transform::translate(v) * toWorld;
+            }
+            else if (operation == "rotate")
+            {
+                double degrees;
+                if (!vector3(v) || !number(degrees))
+                    return false;
+                toWorld = Transform::rotate(v, degrees) * toWorld;
+            }
+            else if (operation == "scale")
+            {
+                if (!vector3(v))
+                    return false;
+                if (v.x() == 0 || v.y() == 0 || v.z() == 0)
+                    return fail("scale factors must not be zero");
+                toWorld = Transform::scale(v) * toWorld;
+            }
+            else
+                return fail("unknown transform " + std::string(operation));
+        }
+        instances.emplace_back(found->second, toWorld);
+        return true;
+    }
+
+    HittableList &target(SceneDescription &scene) { return inGroup ? group : scene.world; }
+
+    bool material()
+    {
+        std::string name(word());
+        std::string_view type = word();
+        if (name.empty())
+            return fail("material needs a name");
+
+        shared_ptr<Material> result;
+        if (type == "lambertian" || type == "light")
+        {
+            shared_ptr<Texture> albedo;
+            if (!colorOrTexture(albedo))
+                return false;
+            if (type == "lambertian")
+                result = make_shared<Lambertian>(albedo);
+            else
+                result = make_shared<DiffuseLight>(albedo);
+        }
+        else if (type == "metal")
+        {
+            Color albedo;
+            double fuzz;
+            if (!vector3(albedo) || !number(fuzz))
+                return false;
+            result = make_shared<Metal>(albedo, fuzz);
+        }
+        else if (type == "dielectric")
+        {
+            double ir;
+            if (!number(ir))
+                return false;
+            result = make_shared<Dielectric>(ir);
+        }
+        else
+            return fail("unknown material type " + std::string(type));
+
+        if (!materials.emplace(name, result).second)
+            return fail("material " + name + " is defined twice");
+        return true;
+    }
+
+    bool texture()
+    {
+        std::string name(word());
+        std::string_view type = word();
+        if (name.empty())
+            return fail("texture needs a name");
+
+        shared_ptr<Texture> result;
+        if (type == "solid")
+        {
+            Color color;
+            if (!vector3(color))
+                return false;
+            result = make_shared<SolidColor>(color);
+        }
+        else if (type == "checker")
+        {
+            double scale;
+            shared_ptr<Texture> even, odd;
+            if (!number(scale) || !textureName(even) || !textureName(odd))
+                return false;
+            result = make_shared<CheckerTexture>(scale, even, odd);
+        }
+        else
+            return fail("unknown texture type " + std::string(type));
+
+        if (!textures.emplace(name, result).second)
+            return fail("texture " + name + " is defined twice");
+        return true;
+    }
+
+    // Consecutive primitives usually share a material, so the last lookup is
+    // remembered and the map is only searched when the name changes.
+    bool materialName(shared_ptr<Material> &material)
+    {
+        std::string_view name = word();
+        if (!lastMaterial || name != lastMaterialName)
+        {
+            key.assign(name.data(), name.size());
+            auto found = materials.find(key);
+            if (found == materials.end())
+                return fail("undefined material " + key);
+            lastMaterialName.assign(name.data(), name.size());
+            lastMaterial = found->second;
+        }
+        material = lastMaterial;
+        return true;
+    }
+
+    bool textureName(shared_ptr<Texture> &texture)
+    {
+        key.assign(word());
+        auto found = textures.find(key);
+        if (found == textures.end())
+            return fail("undefined texture " + key);
+        texture = found->second;
+        return true;
+    }
+
+    // Either three numbers for a solid color or the name of a texture
+    bool colorOrTexture(shared_ptr<Texture> &texture)
+    {
+        skipBlank();
+        if (p < end && (isdigit(static_cast<unsigned char>(*p)) || *p == '-' || *p == '.'))
+        {
+            Color color;
+            if (!vector3(color))
+                return false;
+            texture = make_shared<SolidColor>(color);
+            return true;
+        }
+        return textureName(texture);
+    }
+
+    bool number(double &value)
+    {
+        skipBlank();
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc())
+            return fail("expected a number");
+        p = result.ptr;
+
+        const std::string_view offset = "offset";
+        if (end - p >= static_cast<std::ptrdiff_t>(offset.size()) + 1 && (*p == '-' || *p == '+') &&
+            std::string_view(p + 1, offset.size()) == offset)
+        {
+            value += *p == '-' ? -surface_offset : surface_offset;
+            p += 1 + offset.size();
+        }
+        return true;
+    }
+
+    bool vector3(Vec3 &value)
+    {
+        double x, y, z;
+        if (!number(x) || !number(y) || !number(z))
+            return false;
+        value = Vec3(x, y, z);
+        return true;
+    }
+
+    std::string_view word()
+    {
+        skipBlank();
+        const char *start = p;
+        while (p < end && !isspace(static_cast<unsigned char>(*p)) && *p != '#')
+            p++;
+        return std::string_view(start, p - start);
+    }
+
+    // Skips spaces and a trailing comment, stopping at the end of the line
+    void skipBlank()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+        if (p < end && *p == '#')
+            while (p < end && *p != '\n')
+                p++;
+    }
+
+    bool atLineEnd()
+    {
+        skipBlank();
+        return p == end || *p == '\n';
+    }
+
+    bool fail(const std::string &text)
+    {
+        message = "line " + std::to_string(line) + ": " + text;
+        return false;
+    }
+
+    const char *p;
+    const char *end;
+    std::string directory; // Of the scene file, with a trailing slash
+    size_t line = 1;
+    std::string message;
+
+    std::unordered_map<std::string, shared_ptr<Texture>> textures;
+    std::unordered_map<std::string, shared_ptr<Material>> materials;
+    std::string key;
+    std::string lastMaterialName;
+    shared_ptr<Material> lastMaterial;
+
+    bool inGroup = false;
+    std::string groupName;
+    HittableList group; // Primitives of the open group
+    std::unordered_map<std::string, uint32_t> groups;
+    std::vector<shared_ptr<Hittable>> prototypes;
+    std::vector<Instance> instances;
+};
+
+// Reads a scene file in one go and parses it; on failure `error` says why.
+inline bool load_scene(const std::string &fileName, SceneDescription &scene, std::string &error)
+{
+    std::FILE *file = std::fopen(fileName.c_str(), "rb");
+    if (!file)
+    {
+        error = "cannot open file";
+        return false;
+    }
+
+    std::vector<char> buffer;
+    bool ok = std::fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? std::ftell(file) : -1;
+    ok = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+    if (ok)
+    {
+        buffer.resize(static_cast<size_t>(size));
+        ok = std::fread(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    }
+    std::fclose(file);
+    if (!ok)
+    {
+        error = "cannot read file";
+        return false;
+    }
+
+    size_t slash = fileName.rfind('/');
+    SceneParser parser(buffer.data(), buffer.data() + buffer.size(),
+                       slash == std::string::npos ? "" : fileName.substr(0, slash + 1));
+    if (!parser.parse(scene))
+    {
+        error = parser.error();
+        return false;
+    }
+    return true;
+}
@@ -8,18 +8,26 @@ class Sphere : public Hittable
 {
 private:
     Point3 center;
-    double radius;
+    real radius;
     shared_ptr<Material> material;
 
 public:
     Sphere() {}
-    Sphere(Point3 c, double r, shared_ptr<Material> mat) : center(c), radius(r), material(mat){};
+    Sphere(Point3 c, real r, shared_ptr<Material> mat) : center(c), radius(r), material(mat){};
 
-    virtual bool hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const override;
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual void fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const override { setRecord(ray, point.t, rec); }
     virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override;
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override;
+    virtual int hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const override;
+    virtual double pdfValue(const Point3 &origin, const Vec3 &direction) const override;
+    virtual Vec3 randomDirection(const Point3 &origin) const override;
 
-private:
-    static void getSphereUV(const Point3 &p, double &u, double &v)
+    Point3 getCenter() const { return center; }
+    real getRadius() const { return radius; }
+    shared_ptr<Material> getMaterial() const { return material; }
+
+    static void getSphereUV(const Point3 &p, real &u, real &v)
     {
         auto theta = acos(-p.y());
         auto phi = atan2(-p.z(), p.x()) + pi;
@@ -27,43 +35,150 @@ private:
         u = phi / (2 * pi);
         v = theta / pi;
     }
+
+private:
+    // Both distances at which the ray crosses the sphere, nearest first. The
+    // discriminant comes from the distance between the center and the ray's
+    // closest approach, not from b^2 - ac, which cancels away most of its
+    // digits when the sphere is small next to its distance from the origin.
+    bool roots(const Ray &ray, real &near, real &far) const
+    {
+        Vec3 oc = ray.origin() - center;
+        Vec3 d = ray.direction();
+        real a = d.length_squared();
+        real half_b = dot(oc, d);
+        Vec3 closest = oc - (half_b / a) * d;
+        real discriminant = a * (radius * radius - closest.length_squared());
+        if (discriminant < 0)
+            return false;
+
+        real sqrtd = sqrt(discriminant);
+        near = (-half_b - sqrtd) / a;
+        far = (-half_b + sqrtd) / a;
+        return true;
+    }
+
+    void setRecord(const Ray &ray, double t, HitRecord &rec) const
+    {
+        rec.t = t;
+        rec.p = ray.at(rec.t);
+        Vec3 outward_normal = (rec.p - center) / radius;
+        rec.set_face_normal(ray, outward_normal);
+        getSphereUV(outward_normal, rec.u, rec.v);
+        rec.mat_ptr = material.get();
+    }
 };
 
-bool Sphere::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) const
+bool Sphere::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
 {
-    Vec3 oc = ray.origin() - center;
-    double a = ray.direction().length_squared();
-    double half_b = dot(oc, ray.direction());
-    double c = oc.length_squared() - radius * radius;
-
-    double discriminant = half_b * half_b - a * c;
-    if (discriminant < 0)
+    real near, far;
+    if (!roots(ray, near, far))
         return false;
 
-    double sqrtd = sqrt(discriminant);
-
     // Nearest root in acceptable range.
-    double root = (-half_b - sqrtd) / a;
+    real root = near;
     if (root < t_min || root > t_max)
     {
-        root = (-half_b + sqrtd) / a;
+        root = far;
         if (root < t_min || root > t_max)
             return false;
     }
 
-    rec.t = root;
-    rec.p = ray.at(rec.t);
-    Vec3 outward_normal = (rec.p - center) / radius;
-    rec.set_face_normal(ray, outward_normal);
-    getSphereUV(outward_normal, rec.u, rec.v);
-    rec.mat_ptr = material;
-
+    point.t = root;
+    point.object = this;
     return true;
 }
+
+bool Sphere::occluded(const Ray &ray, double t_min, double t_max) const
+{
+    real near, far;
+    if (!roots(ray, near, far))
+        return false;
+
+    // Either root inside the segment blocks it
+    return (near >= t_min && near <= t_max) || (far >= t_min && far <= t_max);
+}
+
+int Sphere::hitPacket(const RayPacket &packet, int mask, double t_min, double t_max[], HitRecord recs[]) const
+{
+    // Same arithmetic as roots(), in `real`
+    Real4 ocx = Real4(packet.o(0)) - Real4(center.x());
+    Real4 ocy = Real4(packet.o(1)) - Real4(center.y());
+    Real4 ocz = Real4(packet.o(2)) - Real4(center.z());
+    Real4 dx(packet.d(0)), dy(packet.d(1)), dz(packet.d(2));
+
+    Real4 a = dx * dx + dy * dy + dz * dz;
+    Real4 half_b = ocx * dx + ocy * dy + ocz * dz;
+    Real4 s = half_b / a;
+    Real4 lx = ocx - s * dx, ly = ocy - s * dy, lz = ocz - s * dz;
+    Real4 discriminant = a * (Real4(radius * radius) - (lx * lx + ly * ly + lz * lz));
+    Double4 valid = Double4(0.0) <= discriminant;
+
+    Real4 sqrtd = sqrt(max(discriminant, Real4(0.0)));
+    Double4 tMin(t_min);
+    Double4 tMax = Double4::load(t_max);
+
+    // Nearest root in acceptable range.
+    Real4 near = (Real4(0.0) - half_b - sqrtd) / a;
+    Real4 far = (Real4(0.0) - half_b + sqrtd) / a;
+    Double4 nearOk = (tMin <= near) & (near <= tMax);
+    Double4 farOk = (tMin <= far) & (far <= tMax);
+    Double4 root = select(nearOk, near, far);
+
+    int hitMask = (valid & (nearOk | farOk)).bits() & mask;
+    if (!hitMask)
+        return 0;
+
+    alignas(32) double roots[RayPacket::size];
+    root.store(roots);
+    for (int lane = 0; lane < RayPacket::size; lane++)
+    {
+        if (hitMask >> lane & 1)
+        {
+            setRecord(packet.rays[lane], roots[lane], recs[lane]);
+            t_max[lane] = roots[lane];
+        }
+    }
+    return hitMask;
+}
+
 bool Sphere::boundingBox(double time0, double time1, AABB &OutBox) const
 {
     OutBox = AABB(
         center - Vec3(radius, radius, radius),
         center + Vec3(radius, radius, radius));
     return true;
-}
\ No newline at end of file
+}
+double Sphere::pdfValue(const Point3 &origin, const Vec3 &direction) const
+{
+    HitPoint point;
+    if (!intersect(Ray(origin, direction), ray_t_min, infinity, point))
+        return 0.0;
+
+    // Uniform over the cone the sphere subtends, or over all directions from inside
+    real distance_squared = (center - origin).length_squared();
+    if (distance_squared <= radius * radius)
+        return 1 / (4 * pi);
+    real cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    return 1 / (2 * pi * (1 - cos_theta_max));
+}
+
+Vec3 Sphere::randomDirection(const Point3 &origin) const
+{
+    Vec3 direction = center - origin;
+    real distance_squared = direction.length_squared();
+    if (distance_squared <= radius * radius)
+        return random_unit_vector();
+
+    real cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    real phi = 2 * pi * random_double();
+    real z = 1 + random_double() * (cos_theta_max - 1);
+    real r = sqrt(1 - z * z);
+
+    // Orthonormal basis around the direction to the center
+    Vec3 w = unit_vector(direction);
+    Vec3 a = fabs(w.x()) > 0.9 ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+    Vec3 v = unit_vector(cross(w, a));
+    Vec3 u = cross(w, v);
+    return r * cos(phi) * u + r * sin(phi) * v + z * w;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Commons.h"
 #include "Vec3.h"
 #include "Ray.h"
 
@@ -25,4 +26,23 @@ public:
 
 private:
     Color colorVal;
-};
\ No newline at end of file
+};
+
+// Alternates between two textures in a 3D checker pattern
+class CheckerTexture : public Texture
+{
+public:
+    CheckerTexture() {}
+    CheckerTexture(real s, shared_ptr<Texture> e, shared_ptr<Texture> o) : scale(s), even(e), odd(o) {}
+
+    virtual Color value(double u, double v, const Point3 &p) const override
+    {
+        auto sines = sin(scale * p.x()) * sin(scale * p.y()) * sin(scale * p.z());
+        return sines < 0 ? odd->value(u, v, p) : even->value(u, v, p);
+    }
+
+private:
+    real scale = 1;
+    shared_ptr<Texture> even;
+    shared_ptr<Texture> odd;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+struct Tile
+{
+    int x0, y0; // Inclusive
+    int x1, y1; // Exclusive
+};
+
+// Hands out image tiles to a fixed pool of workers. Every worker owns a deque
+// that is seeded round-robin; it pops work from the back of its own deque and,
+// once that runs dry, steals from the front of the other workers' deques.
+class TileScheduler
+{
+private:
+    struct WorkerQueue
+    {
+        std::mutex lock;
+        std::deque<Tile> tiles;
+    };
+
+    std::vector<WorkerQueue> queues;
+
+public:
+    TileScheduler(int width, int height, int tileSize, int workers)
+        : queues(std::max(workers, 1))
+    {
+        size_t next = 0;
+        for (int y = 0; y < height; y += tileSize)
+        {
+            for (int x = 0; x < width; x += tileSize)
+            {
+                Tile tile{x, y, std::min(x + tileSize, width), std::min(y + tileSize, height)};
+                queues[next++ % queues.size()].tiles.push_back(tile);
+            }
+        }
+    }
+
+    size_t tileCount() const
+    {
+        size_t count = 0;
+        for (const auto &queue : queues)
+            count += queue.tiles.size();
+        return count;
+    }
+
+    // Returns false once every queue is empty.
+    bool next(int worker, Tile &out)
+    {
+        {
+            WorkerQueue &own = queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tiles.empty())
+            {
+                out = own.tiles.back();
+                own.tiles.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); i++)
+        {
+            WorkerQueue &victim = queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tiles.empty())
+            {
+                out = victim.tiles.front();
+                victim.tiles.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
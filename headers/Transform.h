@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cmath>
+
+#include "Commons.h"
+#include "Vec3.h"
+#include "Ray.h"
+#include "AABB.h"
+
+// Affine transform kept together with its inverse, each as the top three
+// rows of a 4x4 matrix. Products apply the right-hand transform first.
+class Transform
+{
+private:
+    struct Matrix
+    {
+        double m[3][4];
+    };
+
+    Matrix forward;
+    Matrix backward;
+
+public:
+    Transform() : forward(identity()), backward(identity()) {}
+
+    static Transform translate(const Vec3 &delta)
+    {
+        Matrix a = identity(), b = identity();
+        for (int i = 0; i < 3; i++)
+        {
+            a.m[i][3] = delta[i];
+            b.m[i][3] = -delta[i];
+        }
+        return Transform(a, b);
+    }
+
+    static Transform scale(const Vec3 &factors)
+    {
+        Matrix a = identity(), b = identity();
+        for (int i = 0; i < 3; i++)
+        {
+            a.m[i][i] = factors[i];
+            b.m[i][i] = 1.0 / factors[i];
+        }
+        return Transform(a, b);
+    }
+
+    // Counter-clockwise rotation about `axis` when looking against it
+    static Transform rotate(const Vec3 &axis, double degrees)
+    {
+        Vec3 n = unit_vector(axis);
+        double s = sin(degrees_to_radians(degrees));
+        double c = cos(degrees_to_radians(degrees));
+
+        Matrix a = identity();
+        a.m[0][0] = n.x() * n.x() + (1 - n.x() * n.x()) * c;
+        a.m[0][1] = n.x() * n.y() * (1 - c) - n.z() * s;
+        a.m[0][2] = n.x() * n.z() * (1 - c) + n.y() * s;
+        a.m[1][0] = n.x() * n.y() * (1 - c) + n.z() * s;
+        a.m[1][1] = n.y() * n.y() + (1 - n.y() * n.y()) * c;
+        a.m[1][2] = n.y() * n.z() * (1 - c) - n.x() * s;
+        a.m[2][0] = n.x() * n.z() * (1 - c) - n.y() * s;
+        a.m[2][1] = n.y() * n.z() * (1 - c) + n.x() * s;
+        a.m[2][2] = n.z() * n.z() + (1 - n.z() * n.z()) * c;
+
+        // A rotation's inverse is its transpose
+        Matrix b = identity();
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                b.m[i][j] = a.m[j][i];
+        return Transform(a, b);
+    }
+
+    Transform operator*(const Transform &rhs) const
+    {
+        return Transform(multiply(forward, rhs.forward), multiply(rhs.backward, backward));
+    }
+
+    Transform inverse() const { return Transform(backward, forward); }
+
+    Point3 point(const Point3 &p) const { return applyPoint(forward, p); }
+    Vec3 vector(const Vec3 &v) const { return applyVector(forward, v); }
+
+    // Normals go through the inverse transpose, and are not renormalised
+    Vec3 normal(const Vec3 &n) const
+    {
+        const auto &m = backward.m;
+        return Vec3(m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+                    m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+                    m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z());
+    }
+
+    // Directions are not renormalised, so distances along the ray carry over
+    Ray ray(const Ray &r) const { return Ray(applyPoint(forward, r.origin()), applyVector(forward, r.direction())); }
+    Ray inverseRay(const Ray &r) const { return Ray(applyPoint(backward, r.origin()), applyVector(backward, r.direction())); }
+
+    // Box around the eight transformed corners
+    AABB bounds(const AABB &box) const
+    {
+        Point3 lo(infinity, infinity, infinity), hi(-infinity, -infinity, -infinity);
+        for (int corner = 0; corner < 8; corner++)
+        {
+            Point3 p = point(Point3(corner & 1 ? box.max().x() : box.min().x(),
+                                    corner & 2 ? box.max().y() : box.min().y(),
+                                    corner & 4 ? box.max().z() : box.min().z()));
+            lo = component_min(lo, p);
+            hi = component_max(hi, p);
+        }
+        return AABB(lo, hi);
+    }
+
+private:
+    Transform(const Matrix &a, const Matrix &b) : forward(a), backward(b) {}
+
+    static Matrix identity()
+    {
+        Matrix a = {};
+        a.m[0][0] = a.m[1][1] = a.m[2][2] = 1;
+        return a;
+    }
+
+    static Point3 applyPoint(const Matrix &a, const Point3 &p)
+    {
+        const auto &m = a.m;
+        return Point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                      m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                      m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    static Vec3 applyVector(const Matrix &a, const Vec3 &v)
+    {
+        const auto &m = a.m;
+        return Vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    static Matrix multiply(const Matrix &a, const Matrix &b)
+    {
+        Matrix c;
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                c.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+                if (j == 3)
+                    c.m[i][j] += a.m[i][3];
+            }
+        }
+        return c;
+    }
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Commons.h"
+#include "Vec3.h"
+#include "Ray.h"
+#include "AABB.h"
+#include "Hittable.h"
+#include "Material.h"
+#include "BVH.h"
+
+// Triangles sharing one vertex buffer and one material. Each triangle is
+// three indices into the vertex buffer. The mesh keeps its own BVH whose
+// leaves are ranges of the index buffer, so a mesh is a single object in the
+// scene BVH however many triangles it has, at about 40 bytes per triangle.
+class TriangleMesh : public Hittable
+{
+private:
+    std::vector<Point3> vertices;
+    std::vector<uint32_t> indices; // Three per triangle, in leaf order
+    BVHTree tree;
+    shared_ptr<Material> material;
+
+public:
+    TriangleMesh() {}
+    TriangleMesh(std::vector<Point3> verts, std::vector<uint32_t> triangleIndices, shared_ptr<Material> mat)
+        : vertices(std::move(verts)), indices(std::move(triangleIndices)), material(mat)
+    {
+        std::vector<AABB> bounds(triangleCount());
+        for (size_t i = 0; i < bounds.size(); i++)
+            bounds[i] = triangleBounds(i);
+
+        // Same leaf tuning as FlatScene, for the same cheap non-virtual tests
+        tree.traversalCost = 4.0;
+        tree.maxLeafSize = 16;
+        tree.build(bounds);
+
+        std::vector<uint32_t> sorted(indices.size());
+        for (size_t i = 0; i < tree.primIndices.size(); i++)
+            for (int corner = 0; corner < 3; corner++)
+                sorted[3 * i + corner] = indices[3 * tree.primIndices[i] + corner];
+        indices.swap(sorted);
+        tree.primIndices.clear();
+        tree.primIndices.shrink_to_fit();
+    }
+
+    size_t triangleCount() const { return indices.size() / 3; }
+    size_t vertexCount() const { return vertices.size(); }
+    shared_ptr<Material> getMaterial() const { return material; }
+
+    AABB triangleBounds(size_t i) const
+    {
+        const Point3 &p0 = vertices[indices[3 * i]];
+        const Point3 &p1 = vertices[indices[3 * i + 1]];
+        const Point3 &p2 = vertices[indices[3 * i + 2]];
+        return AABB(component_min(p0, component_min(p1, p2)), component_max(p0, component_max(p1, p2)));
+    }
+
+    size_t memoryBytes() const
+    {
+        return vertices.capacity() * sizeof(Point3) + indices.capacity() * sizeof(uint32_t) +
+               tree.nodes.capacity() * sizeof(BVHNode);
+    }
+
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual void fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const override;
+    virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override;
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override;
+
+private:
+    // Möller–Trumbore. On a hit in [t_min, t_max] returns the distance and the
+    // barycentric coordinates b1, b2 of the second and third vertices.
+    bool hitTriangle(const Ray &ray, size_t i, double t_min, double t_max, double &t, double &b1, double &b2) const
+    {
+        const Point3 &p0 = vertices[indices[3 * i]];
+        Vec3 edge1 = vertices[indices[3 * i + 1]] - p0;
+        Vec3 edge2 = vertices[indices[3 * i + 2]] - p0;
+
+        Vec3 pvec = cross(ray.direction(), edge2);
+        double det = dot(edge1, pvec);
+        if (det == 0)
+            return false;
+        double invDet = 1.0 / det;
+
+        Vec3 tvec = ray.origin() - p0;
+        b1 = dot(tvec, pvec) * invDet;
+        if (b1 < 0 || b1 > 1)
+            return false;
+
+        Vec3 qvec = cross(tvec, edge1);
+        b2 = dot(ray.direction(), qvec) * invDet;
+        if (b2 < 0 || b1 + b2 > 1)
+            return false;
+
+        t = dot(edge2, qvec) * invDet;
+        return t >= t_min && t <= t_max;
+    }
+};
+
+bool TriangleMesh::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
+{
+    uint32_t best = 0;
+    double closest = t_max;
+    bool found = tree.traverse(ray, t_min, t_max,
+                               [&](uint32_t first, uint32_t count, double &leafMax)
+                               {
+                                   bool hitLeaf = false;
+                                   double t, b1, b2;
+                                   for (uint32_t i = first; i < first + count; i++)
+                                   {
+                                       if (hitTriangle(ray, i, t_min, leafMax, t, b1, b2))
+                                       {
+                                           leafMax = t;
+                                           best = i;
+                                           hitLeaf = true;
+                                       }
+                                   }
+                                   if (hitLeaf)
+                                       closest = leafMax;
+                                   return hitLeaf;
+                               });
+    if (!found)
+        return false;
+
+    point.t = closest;
+    point.object = this;
+    point.index = best;
+    return true;
+}
+
+// Barycentrics are recomputed for the one triangle that was hit
+void TriangleMesh::fillRecord(const Ray &ray, const HitPoint &point, HitRecord &rec) const
+{
+    size_t i = point.index;
+    double t, b1 = 0, b2 = 0;
+    hitTriangle(ray, i, -infinity, infinity, t, b1, b2);
+
+    const Point3 &p0 = vertices[indices[3 * i]];
+    Vec3 outward_normal = unit_vector(cross(vertices[indices[3 * i + 1]] - p0, vertices[indices[3 * i + 2]] - p0));
+    rec.t = point.t;
+    rec.p = ray.at(point.t);
+    rec.set_face_normal(ray, outward_normal);
+    rec.u = b1;
+    rec.v = b2;
+    rec.mat_ptr = material.get();
+}
+
+bool TriangleMesh::occluded(const Ray &ray, double t_min, double t_max) const
+{
+    return tree.traverseAny(ray, t_min, t_max,
+                            [&](uint32_t first, uint32_t count)
+                            {
+                                double t, b1, b2;
+                                for (uint32_t i = first; i < first + count; i++)
+                                    if (hitTriangle(ray, i, t_min, t_max, t, b1, b2))
+                                        return true;
+                                return false;
+                            });
+}
+
+bool TriangleMesh::boundingBox(double time0, double time1, AABB &OutBox) const
+{
+    if (tree.empty())
+        return false;
+    OutBox = tree.bounds();
+    return true;
+}
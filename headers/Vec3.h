@@ -3,24 +3,137 @@
 #include <cmath>
 #include <iostream>
 
+#include "Commons.h"
+
+// With -DRT_SIMD_VEC3 a Vec3 is padded to four lanes, aligned to the full
+// register and computed with SSE (float builds) or AVX2 (double builds). The
+// pad lane is kept at zero. Targets without those instructions keep the
+// plain three-element layout.
+#if defined(RT_SIMD_VEC3) && defined(RT_FLOAT) && defined(__SSE__)
+#define VEC3_SIMD
+#include <immintrin.h>
+#elif defined(RT_SIMD_VEC3) && !defined(RT_FLOAT) && defined(__AVX2__)
+#define VEC3_SIMD
+#include <immintrin.h>
+#endif
+
 using std::sqrt;
 
+#ifdef VEC3_SIMD
+// The register operations Vec3 needs, for the one register type that holds
+// four `real`s
+struct Vec3Lanes
+{
+#ifdef RT_FLOAT
+    using Register = __m128;
+
+    static Register set1(float x) { return _mm_set1_ps(x); }
+    static Register set(float x, float y, float z) { return _mm_set_ps(0, z, y, x); }
+    static Register add(Register a, Register b) { return _mm_add_ps(a, b); }
+    static Register sub(Register a, Register b) { return _mm_sub_ps(a, b); }
+    static Register mul(Register a, Register b) { return _mm_mul_ps(a, b); }
+    static Register neg(Register a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    static Register min(Register a, Register b) { return _mm_min_ps(a, b); }
+    static Register max(Register a, Register b) { return _mm_max_ps(a, b); }
+    static Register yzx(Register a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+    // (x + y) + z, the order of the scalar code
+    static float sum3(Register a)
+    {
+        __m128 s = _mm_add_ss(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(a, a)));
+    }
+
+    // 1 / sqrt(x) from the 12-bit estimate and one Newton step
+    static float rsqrt(float x)
+    {
+        __m128 v = _mm_set_ss(x);
+        __m128 r = _mm_rsqrt_ss(v);
+        __m128 half_v_r2 = _mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), v), _mm_mul_ss(r, r));
+        return _mm_cvtss_f32(_mm_mul_ss(r, _mm_sub_ss(_mm_set_ss(1.5f), half_v_r2)));
+    }
+#else
+    using Register = __m256d;
+
+    static Register set1(double x) { return _mm256_set1_pd(x); }
+    static Register set(double x, double y, double z) { return _mm256_set_pd(0, z, y, x); }
+    static Register add(Register a, Register b) { return _mm256_add_pd(a, b); }
+    static Register sub(Register a, Register b) { return _mm256_sub_pd(a, b); }
+    static Register mul(Register a, Register b) { return _mm256_mul_pd(a, b); }
+    static Register neg(Register a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+    static Register min(Register a, Register b) { return _mm256_min_pd(a, b); }
+    static Register max(Register a, Register b) { return _mm256_max_pd(a, b); }
+    static Register yzx(Register a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+    static double sum3(Register a)
+    {
+        __m128d lo = _mm256_castpd256_pd128(a);
+        __m128d s = _mm_add_sd(lo, _mm_unpackhi_pd(lo, lo));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm256_extractf128_pd(a, 1)));
+    }
+
+    // No double-precision estimate instruction below AVX-512
+    static double rsqrt(double x) { return 1 / std::sqrt(x); }
+#endif
+};
+#endif
+
 class Vec3
 {
 private:
-    double e[3];
+#ifdef VEC3_SIMD
+    Vec3Lanes::Register v;
+#else
+    real e[3];
+#endif
 
 public:
+#ifdef VEC3_SIMD
+    Vec3() : v(Vec3Lanes::set1(0)) {}
+    Vec3(real _x, real _y, real _z) : v(Vec3Lanes::set(_x, _y, _z)) {}
+    Vec3(Vec3Lanes::Register r) : v(r) {}
+
+    Vec3Lanes::Register lanes() const { return v; }
+
+    real x() const { return v[0]; }
+    real y() const { return v[1]; }
+    real z() const { return v[2]; }
+
+    real operator[](int i) const { return v[i]; }
+    real &operator[](int i) { return reinterpret_cast<real *>(&v)[i]; }
+#else
     Vec3() : e{0, 0, 0} {}
-    Vec3(double _x, double _y, double _z) : e{_x, _y, _z} {}
+    Vec3(real _x, real _y, real _z) : e{_x, _y, _z} {}
+
+    real x() const { return e[0]; }
+    real y() const { return e[1]; }
+    real z() const { return e[2]; }
+
+    real operator[](int i) const { return e[i]; }
+    real &operator[](int i) { return e[i]; }
+#endif
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+#ifdef VEC3_SIMD
+    Vec3 operator-() const { return Vec3Lanes::neg(lanes()); }
 
+    Vec3 &operator+=(const Vec3 &u)
+    {
+        v = Vec3Lanes::add(v, u.v);
+        return *this;
+    }
+
+    Vec3 &operator*=(const real t)
+    {
+        v = Vec3Lanes::mul(v, Vec3Lanes::set1(t));
+        return *this;
+    }
+
+    real length_squared() const
+    {
+        return Vec3Lanes::sum3(Vec3Lanes::mul(v, v));
+    }
+#else
     Vec3 operator-() const { return Vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double &operator[](int i) { return e[i]; }
 
     Vec3 &operator+=(const Vec3 &v)
     {
@@ -30,7 +143,7 @@ public:
         return *this;
     }
 
-    Vec3 &operator*=(const double t)
+    Vec3 &operator*=(const real t)
     {
         e[0] *= t;
         e[1] *= t;
@@ -38,25 +151,26 @@ public:
         return *this;
     }
 
-    Vec3 &operator/=(const double t)
+    real length_squared() const
     {
-        return *this *= 1 / t;
+        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
     }
+#endif
 
-    double length() const
+    Vec3 &operator/=(const real t)
     {
-        return sqrt(length_squared());
+        return *this *= 1 / t;
     }
 
-    double length_squared() const
+    real length() const
     {
-        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+        return sqrt(length_squared());
     }
 
     bool near_zero() const
     {
-        const double z = 1e-8;
-        return (fabs(e[0]) < z) && (fabs(e[1]) < z) && (fabs(e[2]) < z);
+        const real s = 1e-8;
+        return (fabs(x()) < s) && (fabs(y()) < s) && (fabs(z()) < s);
     }
 
     inline static Vec3 random()
@@ -64,7 +178,7 @@ public:
         return Vec3(random_double(), random_double(), random_double());
     }
 
-    inline static Vec3 random(double min, double max)
+    inline static Vec3 random(real min, real max)
     {
         return Vec3(random_double(min, max), random_double(min, max), random_double(min, max));
     }
@@ -78,37 +192,71 @@ inline std::ostream &operator<<(std::ostream &out, const Vec3 &v)
     return out << v.x() << ' ' << v.y() << ' ' << v.z();
 }
 
+#ifdef VEC3_SIMD
 inline Vec3 operator+(const Vec3 &u, const Vec3 &v)
 {
-    return Vec3(u.x() + v.x(), u.y() + v.y(), u.z() + v.z());
+    return Vec3Lanes::add(u.lanes(), v.lanes());
 }
 
 inline Vec3 operator-(const Vec3 &u, const Vec3 &v)
 {
-    return Vec3(u.x() - v.x(), u.y() - v.y(), u.z() - v.z());
+    return Vec3Lanes::sub(u.lanes(), v.lanes());
 }
 
 inline Vec3 operator*(const Vec3 &u, const Vec3 &v)
 {
-    return Vec3(u.x() * v.x(), u.y() * v.y(), u.z() * v.z());
+    return Vec3Lanes::mul(u.lanes(), v.lanes());
 }
 
-inline Vec3 operator*(double t, const Vec3 &v)
+inline Vec3 operator*(real t, const Vec3 &v)
 {
-    return Vec3(t * v.x(), t * v.y(), t * v.z());
+    return Vec3Lanes::mul(Vec3Lanes::set1(t), v.lanes());
 }
 
-inline Vec3 operator*(const Vec3 &v, double t)
+inline real dot(const Vec3 &u, const Vec3 &v)
 {
-    return t * v;
+    return Vec3Lanes::sum3(Vec3Lanes::mul(u.lanes(), v.lanes()));
 }
 
-inline Vec3 operator/(Vec3 v, double t)
+// u.yzx * v.zxy - u.zxy * v.yzx, with one shuffle fewer
+inline Vec3 cross(const Vec3 &u, const Vec3 &v)
 {
-    return (1 / t) * v;
+    auto a = u.lanes(), b = v.lanes();
+    auto c = Vec3Lanes::sub(Vec3Lanes::mul(a, Vec3Lanes::yzx(b)), Vec3Lanes::mul(Vec3Lanes::yzx(a), b));
+    return Vec3Lanes::yzx(c);
+}
+
+inline Vec3 component_min(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3Lanes::min(u.lanes(), v.lanes());
+}
+
+inline Vec3 component_max(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3Lanes::max(u.lanes(), v.lanes());
+}
+#else
+inline Vec3 operator+(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3(u.x() + v.x(), u.y() + v.y(), u.z() + v.z());
 }
 
-inline double dot(const Vec3 &u, const Vec3 &v)
+inline Vec3 operator-(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3(u.x() - v.x(), u.y() - v.y(), u.z() - v.z());
+}
+
+inline Vec3 operator*(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3(u.x() * v.x(), u.y() * v.y(), u.z() * v.z());
+}
+
+inline Vec3 operator*(real t, const Vec3 &v)
+{
+    return Vec3(t * v.x(), t * v.y(), t * v.z());
+}
+
+inline real dot(const Vec3 &u, const Vec3 &v)
 {
     return u.x() * v.x() + u.y() * v.y() + u.z() * v.z();
 }
@@ -120,11 +268,43 @@ inline Vec3 cross(const Vec3 &u, const Vec3 &v)
                 u.x() * v.y() - u.y() * v.x());
 }
 
+inline Vec3 component_min(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3(fmin(u.x(), v.x()), fmin(u.y(), v.y()), fmin(u.z(), v.z()));
+}
+
+inline Vec3 component_max(const Vec3 &u, const Vec3 &v)
+{
+    return Vec3(fmax(u.x(), v.x()), fmax(u.y(), v.y()), fmax(u.z(), v.z()));
+}
+#endif
+
+inline Vec3 operator*(const Vec3 &v, real t)
+{
+    return t * v;
+}
+
+inline Vec3 operator/(Vec3 v, real t)
+{
+    return (1 / t) * v;
+}
+
 inline Vec3 unit_vector(Vec3 v)
 {
     return v / v.length();
 }
 
+// unit_vector through the reciprocal square root estimate where the target
+// has one, for directions that tolerate a relative error of about 1e-7
+inline Vec3 unit_vector_fast(const Vec3 &v)
+{
+#ifdef VEC3_SIMD
+    return Vec3Lanes::rsqrt(v.length_squared()) * v;
+#else
+    return unit_vector(v);
+#endif
+}
+
 inline Vec3 random_in_unit_sphere()
 {
     while (true)
@@ -138,7 +318,7 @@ inline Vec3 random_in_unit_sphere()
 
 inline Vec3 random_unit_vector()
 {
-    return unit_vector(random_in_unit_sphere());
+    return unit_vector_fast(random_in_unit_sphere());
 }
 
 inline Vec3 ranomd_in_hemisphere(const Vec3 &normal)
@@ -155,11 +335,11 @@ inline Vec3 reflect(const Vec3 &v, const Vec3 &n)
     return v - 2 * dot(v, n) * n;
 }
 
-inline Vec3 refract(const Vec3 &uv, const Vec3 &n, double ei)
+inline Vec3 refract(const Vec3 &uv, const Vec3 &n, real ei)
 {
-    double cos_theta = fmin(dot(-uv, n), 1.0);
+    real cos_theta = fmin(dot(-uv, n), 1.0);
     Vec3 r_out_perp = ei * (uv + cos_theta * n);
     Vec3 r_out_parallell = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
 
     return r_out_perp + r_out_parallell;
-}
\ No newline at end of file
+}
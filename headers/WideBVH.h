@@ -0,0 +1,318 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Commons.h"
+#include "Packet.h"
+#include "BVH.h"
+#include "Profiler.h"
+
+// Four-wide BVH node. Child bounds are stored as structure-of-arrays so one
+// Double4 slab test covers all children. Leaf children are stored inline as a
+// primitive range; empty slots are cleared from `valid`.
+struct alignas(64) BVH4Node
+{
+    float bmin[3][4];
+    float bmax[3][4];
+    uint32_t child[4]; // Node index for inner children, first primitive for leaves
+    uint16_t count[4]; // 0 for inner children
+    uint32_t valid;    // Bit i set when slot i is used
+
+    // Returns the mask of children entered and their entry distances.
+    int enter(const Double4 origin[3], const Double4 invDir[3], double t_min, double t_max, double tEnter[4]) const
+    {
+        Double4 tNear(t_min);
+        Double4 tFar(t_max);
+        for (int i = 0; i < 3; i++)
+        {
+            Double4 t0 = (Double4::load(bmin[i]) - origin[i]) * invDir[i];
+            Double4 t1 = (Double4::load(bmax[i]) - origin[i]) * invDir[i];
+            tNear = max(tNear, min(t0, t1));
+            tFar = min(tFar, max(t0, t1));
+        }
+        tNear.store(tEnter);
+        return (tNear <= tFar).bits() & valid;
+    }
+};
+
+static_assert(sizeof(BVH4Node) == 128, "BVH4Node must stay two cache lines");
+
+// BVH4 built by collapsing a binary BVHTree: each wide node repeatedly opens
+// its largest inner child until it holds four children or only leaves.
+class BVH4Tree
+{
+public:
+    std::vector<BVH4Node> nodes;
+    std::vector<uint32_t> primIndices;
+
+public:
+    BVH4Tree() {}
+
+    void build(const BVHTree &binary)
+    {
+        nodes.clear();
+        primIndices = binary.primIndices;
+        if (binary.empty())
+            return;
+
+        nodes.reserve(binary.nodes.size() / 2 + 1);
+        nodes.emplace_back();
+        collapse(binary, 0, 0);
+    }
+
+    bool empty() const { return nodes.empty(); }
+
+    // Same contract as BVHTree::traverse.
+    template <typename LeafHit>
+    bool traverse(const Ray &ray, double t_min, double t_max, LeafHit &&leafHit) const
+    {
+        if (nodes.empty())
+            return false;
+
+        const Point3 o = ray.origin();
+        const Vec3 d = ray.direction();
+        const Double4 origin[3] = {Double4(o.x()), Double4(o.y()), Double4(o.z())};
+        const Double4 invDir[3] = {Double4(1.0 / d.x()), Double4(1.0 / d.y()), Double4(1.0 / d.z())};
+
+        struct Entry
+        {
+            uint32_t child;
+            uint16_t count;
+            double t;
+        };
+        // A wide node is never deeper than its binary root, and each one
+        // popped leaves at most three more entries on the stack
+        Entry stack[3 * BVHTree::maxDepth + 1];
+        int stackSize = 0;
+        stack[stackSize++] = Entry{0, 0, t_min};
+        bool hitAnything = false;
+
+        while (stackSize > 0)
+        {
+            Entry entry = stack[--stackSize];
+            if (entry.t > t_max)
+                continue;
+
+            if (entry.count)
+            {
+                PROFILE_COUNT(primitiveTests, entry.count);
+                if (leafHit(entry.child, entry.count, t_max))
+                    hitAnything = true;
+                continue;
+            }
+
+            const BVH4Node &node = nodes[entry.child];
+            PROFILE_COUNT(nodesVisited, 1);
+            alignas(32) double tEnter[4];
+            int mask = node.enter(origin, invDir, t_min, t_max, tEnter);
+
+            // Push entered children far to near so the nearest is popped next.
+            int first = stackSize;
+            for (int slot = 0; slot < 4; slot++)
+            {
+                if (!(mask >> slot & 1))
+                    continue;
+                Entry child{node.child[slot], node.count[slot], tEnter[slot]};
+                int k = stackSize++;
+                while (k > first && stack[k - 1].t < child.t)
+                {
+                    stack[k] = stack[k - 1];
+                    k--;
+                }
+                stack[k] = child;
+            }
+        }
+
+        return hitAnything;
+    }
+
+    // Same contract as BVHTree::traverseAny.
+    template <typename LeafTest>
+    bool traverseAny(const Ray &ray, double t_min, double t_max, LeafTest &&leafTest) const
+    {
+        if (nodes.empty())
+            return false;
+
+        const Point3 o = ray.origin();
+        const Vec3 d = ray.direction();
+        const Double4 origin[3] = {Double4(o.x()), Double4(o.y()), Double4(o.z())};
+        const Double4 invDir[3] = {Double4(1.0 / d.x()), Double4(1.0 / d.y()), Double4(1.0 / d.z())};
+
+        uint32_t stack[3 * BVHTree::maxDepth + 1];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const BVH4Node &node = nodes[stack[--stackSize]];
+            PROFILE_COUNT(nodesVisited, 1);
+            alignas(32) double tEnter[4];
+            int mask = node.enter(origin, invDir, t_min, t_max, tEnter);
+
+            for (int slot = 0; slot < 4; slot++)
+            {
+                if (!(mask >> slot & 1))
+                    continue;
+                if (!node.count[slot])
+                {
+                    stack[stackSize++] = node.child[slot];
+                    continue;
+                }
+                PROFILE_COUNT(primitiveTests, node.count[slot]);
+                if (leafTest(node.child[slot], node.count[slot]))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static double area(const BVHNode &node)
+    {
+        double dx = node.bmax[0] - node.bmin[0];
+        double dy = node.bmax[1] - node.bmin[1];
+        double dz = node.bmax[2] - node.bmin[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    void collapse(const BVHTree &binary, uint32_t binaryIndex, size_t wideIndex)
+    {
+        // Gather up to four binary subtrees under this wide node.
+        uint32_t children[4];
+        int childCount = 0;
+        const BVHNode &root = binary.nodes[binaryIndex];
+        if (root.isLeaf())
+        {
+            children[childCount++] = binaryIndex;
+        }
+        else
+        {
+            children[childCount++] = binaryIndex + 1;
+            children[childCount++] = root.offset;
+        }
+
+        while (childCount < 4)
+        {
+            int largest = -1;
+            for (int i = 0; i < childCount; i++)
+            {
+                const BVHNode &candidate = binary.nodes[children[i]];
+                if (!candidate.isLeaf() && (largest < 0 || area(candidate) > area(binary.nodes[children[largest]])))
+                    largest = i;
+            }
+            if (largest < 0)
+                break;
+
+            uint32_t opened = children[largest];
+            children[largest] = opened + 1;
+            children[childCount++] = binary.nodes[opened].offset;
+        }
+
+        BVH4Node &node = nodes[wideIndex];
+        node.valid = (1u << childCount) - 1;
+        for (int slot = 0; slot < 4; slot++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                node.bmin[axis][slot] = slot < childCount ? binary.nodes[children[slot]].bmin[axis] : 0.0f;
+                node.bmax[axis][slot] = slot < childCount ? binary.nodes[children[slot]].bmax[axis] : 0.0f;
+            }
+            node.child[slot] = 0;
+            node.count[slot] = 0;
+        }
+
+        for (int slot = 0; slot < childCount; slot++)
+        {
+            const BVHNode &child = binary.nodes[children[slot]];
+            if (child.isLeaf())
+            {
+                nodes[wideIndex].child[slot] = child.offset;
+                nodes[wideIndex].count[slot] = child.count;
+            }
+            else
+            {
+                uint32_t index = static_cast<uint32_t>(nodes.size());
+                nodes.emplace_back();
+                nodes[wideIndex].child[slot] = index;
+                collapse(binary, children[slot], index);
+            }
+        }
+    }
+};
+
+// Hittable front end over BVH4Tree, interchangeable with BVH.
+class BVH4 : public Hittable
+{
+private:
+    BVH4Tree tree;
+    AABB box;
+    std::vector<shared_ptr<Hittable>> primitives; // In leaf order
+
+public:
+    BVH4() {}
+    BVH4(const HittableList &list, double time0 = 0, double time1 = 0)
+    {
+        std::vector<AABB> bounds(list.objects.size());
+        for (size_t i = 0; i < list.objects.size(); i++)
+        {
+            if (!list.objects[i]->boundingBox(time0, time1, bounds[i]))
+                std::cerr << "No bounding box in BVH4 constructor.\n";
+        }
+
+        BVHTree binary(bounds);
+        if (!binary.empty())
+            box = binary.bounds();
+        tree.build(binary);
+
+        primitives.reserve(list.objects.size());
+        for (uint32_t index : tree.primIndices)
+            primitives.push_back(list.objects[index]);
+    }
+
+    size_t nodeCount() const { return tree.nodes.size(); }
+
+    virtual bool intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const override;
+    virtual bool boundingBox(double time0, double time1, AABB &OutBox) const override;
+    virtual bool occluded(const Ray &ray, double t_min, double t_max) const override;
+};
+
+bool BVH4::intersect(const Ray &ray, double t_min, double t_max, HitPoint &point) const
+{
+    return tree.traverse(ray, t_min, t_max,
+                         [&](uint32_t first, uint32_t count, double &closest)
+                         {
+                             bool hitAnything = false;
+                             for (uint32_t i = first; i < first + count; i++)
+                             {
+                                 if (primitives[i]->intersect(ray, t_min, closest, point))
+                                 {
+                                     hitAnything = true;
+                                     closest = point.t;
+                                 }
+                             }
+                             return hitAnything;
+                         });
+}
+
+bool BVH4::boundingBox(double time0, double time1, AABB &OutBox) const
+{
+    if (tree.empty())
+        return false;
+    OutBox = box;
+    return true;
+}
+
+bool BVH4::occluded(const Ray &ray, double t_min, double t_max) const
+{
+    return tree.traverseAny(ray, t_min, t_max,
+                            [&](uint32_t first, uint32_t count)
+                            {
+                                for (uint32_t i = first; i < first + count; i++)
+                                {
+                                    if (primitives[i]->occluded(ray, t_min, t_max))
+                                        return true;
+                                }
+                                return false;
+                            });
+}
@@ -1,10 +1,17 @@
-#include <fstream>
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
-#include <sys/stat.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeindex>
 #include <vector>
 
 #include "headers/Commons.h"
 #include "headers/Color.h"
+#include "headers/Image.h"
+#include "headers/Accumulator.h"
 #include "headers/Ray.h"
 #include "headers/Vec3.h"
 #include "headers/HittableList.h"
@@ -12,121 +19,1183 @@
 #include "headers/Camera.h"
 #include "headers/Material.h"
 #include "headers/AARect.h"
+#include "headers/BVH.h"
+#include "headers/WideBVH.h"
+#include "headers/FlatScene.h"
+#include "headers/LightList.h"
+#include "headers/SceneLoader.h"
+#include "headers/SceneCache.h"
+#include "headers/TileScheduler.h"
+#include "headers/Profiler.h"
+#include "headers/Benchmark.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace std;
 
 //Initialize Scenes
 HittableList first_default();
 HittableList light_and_sphere();
-HittableList cornell_box();
+HittableList cornell_box(shared_ptr<Hittable> leftObject = nullptr);
+HittableList sphere_field(size_t count, bool pooled = true);
+HittableList dense_spheres(size_t count);
 
-inline bool file_exists(const string &name)
+inline bool ends_with(const string &value, const string &suffix)
 {
-    struct stat buffer;
-    return (stat(name.c_str(), &buffer) == 0);
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
 
-inline void save_file(vector<Color> pixelValues, const int width, const int height, const int samples_per_pixel)
+// Writes a float map for .pfm file names and a binary 8-bit PPM otherwise.
+inline bool save_file(const string &fileName, const vector<Color> &pixelValues, const int width, const int height, const int samples_per_pixel)
 {
-    char fileName[] = "raytrace.ppm";
-    // Delete old image if it exists
-    if (file_exists(fileName))
-    {
-        remove(fileName);
-    }
+    PROFILE_SCOPE(PhaseOutput);
+    bool saved = ends_with(fileName, ".pfm")
+                     ? write_pfm(fileName, pixelValues, width, height, samples_per_pixel)
+                     : write_ppm(fileName, pixelValues, width, height, samples_per_pixel);
 
-    ofstream ofs("raytrace.ppm", ios_base::out | ios_base::binary);
-    ofs << "P3" << endl
-        << width << ' ' << height << endl
-        << "255" << endl;
+    if (!saved)
+        cerr << "Could not write " << fileName << "\n";
+    else
+        cerr << "\nSaved " << fileName << "\n";
+    return saved;
+}
 
-    for (auto const &pixel : pixelValues)
+struct RenderSettings
+{
+    double aspect_ratio = 4.0 / 3.0;
+    int width = 100;
+    int height = 75;
+    int samples_per_pixel = 80;
+    int max_depth = 10;
+    int rr_depth = 0; // Bounce after which Russian roulette may end a path, 0 disables it
+    int threads = 1;
+    bool packets = false; // Trace primary rays in 2x2 packets
+    bool wavefront = false; // Trace batches of paths bounce by bounce
+    int wavefront_batch = 1024; // Paths in flight per wavefront batch
+    int pass_samples = 0; // Samples per progressive pass, 0 renders everything in one pass
+    double checkpoint_interval = 0; // Minimum seconds between progressive checkpoints
+    double noise_threshold = 0; // Relative error at which adaptive sampling stops a pixel, 0 samples uniformly
+    int min_samples = 16; // Samples every pixel gets before adaptive sampling may stop it
+    int max_samples = 0; // Per-pixel cap for adaptive sampling, 0 means 8 * samples_per_pixel
+    bool nee = true; // Sample the lights directly at diffuse bounces
+    uint64_t seed = 0;
+    Color background = Color(0, 0, 0);
+};
+
+struct PathStats
+{
+    uint64_t paths = 0;
+    uint64_t bounces = 0;
+    uint64_t secondary_rays = 0; // Rays traced after a bounce, the camera rays are `paths`
+    uint64_t roulette_kills = 0;
+    uint64_t roulette_skipped = 0; // Bounces left to max_depth when roulette ended a path
+    uint64_t shadow_rays = 0;
+
+    void merge(const PathStats &other)
     {
-        write_color(ofs, pixel, samples_per_pixel);
+        paths += other.paths;
+        bounces += other.bounces;
+        secondary_rays += other.secondary_rays;
+        roulette_kills += other.roulette_kills;
+        roulette_skipped += other.roulette_skipped;
+        shadow_rays += other.shadow_rays;
     }
+};
 
-    ofs.close();
-    cerr << "\nDone.\n";
+inline double power_heuristic(double pdf, double other_pdf)
+{
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
 }
 
-Color ray_color(const Ray &r, const Color &background, const HittableList &world, int depth)
+// Shadow ray from next-event estimation; `radiance` reaches the path when
+// nothing blocks the ray before t_max.
+struct ShadowRay
 {
-    HitRecord rec;
+    Ray ray;
+    double t_max;
+    Color radiance;
+};
+
+// State a path carries from one bounce to the next
+struct PathState
+{
+    Ray ray;
+    Color throughput = Color(1, 1, 1);
+    Color radiance = Color(0, 0, 0);
+    double scatter_pdf = 0; // Density `ray` was scattered with, 0 after specular bounces
+    int depth = 0;
+};
 
-    if (depth <= 0)
-        return Color(0, 0, 0);
+// World queries of the renderers, in one place so that profiling builds can
+// count and time them. `depth` is the number of bounces before the ray.
+inline bool closest_hit(const Hittable &world, const Ray &ray, int depth, HitRecord &rec)
+{
+    PROFILE_SCOPE(PhaseIntersection);
+    PROFILE_RAY(depth);
+    return world.hit(ray, ray_t_min, infinity, rec);
+}
 
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
+inline bool shadow_blocked(const Hittable &world, const ShadowRay &shadow)
+{
+    PROFILE_SCOPE(PhaseIntersection);
+    return world.occluded(shadow.ray, ray_t_min, shadow.t_max);
+}
+
+// Next-event estimation at a non-specular hit: light arriving along a direction
+// sampled towards the lights, multiplied by the material's scattering pdf
+// and MIS weighted. The caller multiplies by the path weight. Returns false
+// when the sample cannot contribute.
+bool sample_lights(const Ray &ray_in, const HitRecord &rec, const LightList &lights, ShadowRay &shadow)
+{
+    const Hittable &light = lights.pick();
+    shadow.ray = Ray(rec.p, light.randomDirection(rec.p));
+    double scatter_pdf = rec.mat_ptr->scatteringPdf(ray_in, rec, shadow.ray);
+    HitRecord light_rec;
+    if (scatter_pdf <= 0 || !light.hit(shadow.ray, ray_t_min, infinity, light_rec))
+        return false;
+    double light_pdf = lights.pdfValue(rec.p, shadow.ray.direction());
+
+    // Stop just short of the light so it does not shadow itself
+    shadow.t_max = light_rec.t * (1 - shadow_margin);
+    double weight = power_heuristic(light_pdf, scatter_pdf);
+    shadow.radiance = light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p) * (weight * scatter_pdf / light_pdf);
+    return true;
+}
+
+// One bounce of `path` at its hit `rec`: adds the emission, scatters and
+// applies Russian roulette, leaving the continuation in path.ray. A shadow
+// ray, already weighted by the path, is returned through `shadow` when
+// has_shadow is set. Returns false when the path ends here.
+bool shade_hit(PathState &path, const HitRecord &rec, const LightList &lights, const RenderSettings &settings, PathStats &stats,
+               ShadowRay &shadow, bool &has_shadow)
+{
+    PROFILE_SCOPE(PhaseMaterial);
+    const bool nee = settings.nee && !lights.empty();
+    has_shadow = false;
+    stats.bounces++;
+
+    // A light reached by a non-specular bounce could also have been
+    // found by next-event estimation at the previous hit.
+    Color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    if (nee && path.scatter_pdf > 0 && rec.mat_ptr->isLight())
+        emitted *= power_heuristic(path.scatter_pdf, lights.pdfValue(path.ray.origin(), path.ray.direction()));
+    path.radiance += path.throughput * emitted;
 
     Ray scattered;
     Color attenuation;
-    Color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    PROFILE_SCATTER(*rec.mat_ptr);
+    if (!rec.mat_ptr->scatter(path.ray, rec, attenuation, scattered))
+        return false;
 
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
+    path.scatter_pdf = 0;
+    if (nee && !rec.mat_ptr->isSpecular())
+    {
+        if (sample_lights(path.ray, rec, lights, shadow))
+        {
+            shadow.radiance = path.throughput * attenuation * shadow.radiance;
+            has_shadow = true;
+            PROFILE_SHADOW_RAY(path.depth);
+        }
+        path.scatter_pdf = rec.mat_ptr->scatteringPdf(path.ray, rec, scattered);
+    }
+    path.throughput = path.throughput * attenuation;
+
+    // Russian roulette: continue with probability p and reweight by 1 / p,
+    // which keeps the estimate unbiased while cutting dim paths short.
+    if (settings.rr_depth > 0 && path.depth + 1 >= settings.rr_depth)
+    {
+        double p = clamp(fmax(path.throughput.x(), fmax(path.throughput.y(), path.throughput.z())), 0.05, 1.0);
+        if (random_double() >= p)
+        {
+            stats.roulette_kills++;
+            stats.roulette_skipped += settings.max_depth - path.depth - 1;
+            return false;
+        }
+        path.throughput /= p;
+    }
 
-    return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
+    path.ray = scattered;
+    if (++path.depth >= settings.max_depth)
+        return false;
+    stats.secondary_rays++;
+    return true;
 }
 
-vector<Color> generate_image(
-    const double aspect_ratio,
-    const int width,
-    const int height,
-    const HittableList &world,
-    const int samples_per_pixel,
-    const int max_depth,
-    const Color &background)
+// Follows a path whose first intersection (`hit`, `rec`) is already known.
+Color trace_path(const Ray &r, bool hit, HitRecord &rec, const Hittable &world, const LightList &lights, const RenderSettings &settings, PathStats &stats)
 {
-    // Empty Vector
-    vector<Color> p;
+    PathState path;
+    path.ray = r;
 
-    // Camera
-    Camera cam(100, aspect_ratio);
+    stats.paths++;
+    while (true)
+    {
+        if (!hit)
+        {
+            path.radiance += path.throughput * settings.background;
+            break;
+        }
 
-    // Generate Pixels
-    for (int j = height - 1; j >= 0; --j)
+        ShadowRay shadow;
+        bool has_shadow;
+        bool alive = shade_hit(path, rec, lights, settings, stats, shadow, has_shadow);
+        if (has_shadow)
+        {
+            stats.shadow_rays++;
+            if (!shadow_blocked(world, shadow))
+                path.radiance += shadow.radiance;
+        }
+        if (!alive)
+            break;
+        hit = closest_hit(world, path.ray, path.depth, rec);
+    }
+
+    return path.radiance;
+}
+
+Color ray_color(const Ray &r, const Hittable &world, const LightList &lights, const RenderSettings &settings, PathStats &stats)
+{
+    PROFILE_SCOPE(PhaseRayColor);
+    HitRecord rec;
+    bool hit = closest_hit(world, r, 0, rec);
+    return trace_path(r, hit, rec, world, lights, settings, stats);
+}
+
+// Adds samples [acc.samples[pixel], target) to every pixel of the tile that
+// adaptive sampling has not stopped.
+void render_tile(
+    const Tile &tile,
+    const Camera &cam,
+    const Hittable &world,
+    const LightList &lights,
+    const RenderSettings &settings,
+    const uint32_t target,
+    PathStats &stats,
+    Accumulator &acc)
+{
+    for (int y = tile.y0; y < tile.y1; ++y)
     {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < width; ++i)
+        // Rows are stored top-down, the camera counts scanlines bottom-up.
+        int j = settings.height - 1 - y;
+        for (int i = tile.x0; i < tile.x1; ++i)
         {
-            Color pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s)
+            size_t index = static_cast<size_t>(y) * settings.width + i;
+            if (acc.converged[index])
+                continue;
+            PROFILE_MARK(pixel_start);
+            for (uint32_t s = acc.samples[index]; s < target; ++s)
             {
-                double u = (i + random_double()) / (width - 1);
-                double v = (j + random_double()) / (height - 1);
+                begin_sample(settings.seed, index, s);
+                double u = (i + random_double()) / (settings.width - 1);
+                double v = (j + random_double()) / (settings.height - 1);
                 Ray r = cam.getRay(u, v);
-                pixel_color += ray_color(r, background, world, max_depth);
+                acc.add(index, ray_color(r, world, lights, settings, stats));
             }
-            p.push_back(pixel_color);
+            PROFILE_PIXEL_COST(index, profile_cost() - pixel_start);
         }
     }
-    cerr << "\nDone.\n";
+}
+
+// Same result as render_tile, but the primary rays of each 2x2 pixel block are
+// intersected as one packet. Every lane keeps its own sampler state so the
+// rest of the path consumes exactly the random numbers the scalar path would.
+void render_tile_packets(
+    const Tile &tile,
+    const Camera &cam,
+    const Hittable &world,
+    const LightList &lights,
+    const RenderSettings &settings,
+    const uint32_t target,
+    PathStats &stats,
+    Accumulator &acc)
+{
+    for (int y = tile.y0; y < tile.y1; y += 2)
+    {
+        for (int x = tile.x0; x < tile.x1; x += 2)
+        {
+            size_t index[RayPacket::size];
+            uint32_t first[RayPacket::size];
+            int lanes = 0;
+            uint32_t block_first = target;
+            for (int lane = 0; lane < RayPacket::size; ++lane)
+            {
+                int i = x + (lane & 1);
+                int row = y + (lane >> 1);
+                if (i >= tile.x1 || row >= tile.y1)
+                    continue;
+                index[lane] = static_cast<size_t>(row) * settings.width + i;
+                if (acc.converged[index[lane]])
+                    continue;
+                first[lane] = acc.samples[index[lane]];
+                block_first = min(block_first, first[lane]);
+                lanes |= 1 << lane;
+            }
 
-    return p;
+            for (uint32_t s = block_first; s < target; ++s)
+            {
+                PROFILE_SCOPE(PhaseRayColor);
+                RayPacket packet;
+                Pcg32 lane_rng[RayPacket::size];
+                for (int lane = 0; lane < RayPacket::size; ++lane)
+                {
+                    if (!(lanes >> lane & 1) || s < first[lane])
+                        continue;
+
+                    int i = x + (lane & 1);
+                    int j = settings.height - 1 - (y + (lane >> 1));
+                    begin_sample(settings.seed, index[lane], s);
+                    double u = (i + random_double()) / (settings.width - 1);
+                    double v = (j + random_double()) / (settings.height - 1);
+                    packet.set(lane, cam.getRay(u, v));
+                    lane_rng[lane] = thread_sampler();
+                }
+                packet.pad();
+
+                alignas(32) double t_max[RayPacket::size] = {infinity, infinity, infinity, infinity};
+                HitRecord recs[RayPacket::size];
+                PROFILE_MARK(packet_start);
+                int hits;
+                {
+                    PROFILE_SCOPE(PhaseIntersection);
+                    PROFILE_COUNT(rays[0], __builtin_popcount(packet.active));
+                    hits = world.hitPacket(packet, packet.active, ray_t_min, t_max, recs);
+                }
+                PROFILE_MARK(packet_end);
+
+                for (int lane = 0; lane < RayPacket::size; ++lane)
+                {
+                    if (!(packet.active >> lane & 1))
+                        continue;
+                    PROFILE_MARK(lane_start);
+                    thread_sampler() = lane_rng[lane];
+                    acc.add(index[lane], trace_path(packet.rays[lane], hits >> lane & 1, recs[lane], world, lights, settings, stats));
+                    // The packet traversal is shared evenly between its lanes
+                    PROFILE_PIXEL_COST(index[lane], profile_cost() - lane_start +
+                                                        static_cast<double>(packet_end - packet_start) / __builtin_popcount(packet.active));
+                }
+            }
+        }
+    }
 }
 
-int main()
+// Wavefront version of render_tile: batches of samples are in flight at once
+// and advance one bounce per round. Each round intersects the whole queue,
+// shades the hits grouped by material type, traces the shadow rays that
+// produced, and compacts the surviving paths into the next queue. Paths carry
+// their own sampler, so the image matches render_tile bit for bit.
+void render_tile_wavefront(
+    const Tile &tile,
+    const Camera &cam,
+    const Hittable &world,
+    const LightList &lights,
+    const RenderSettings &settings,
+    const uint32_t target,
+    PathStats &stats,
+    Accumulator &acc)
 {
-    // Screen
-    const double aspect_ratio = 4.0 / 3.0;
-    const int width = 100;
-    const int height = static_cast<int>(width / aspect_ratio);
-    const int samples_per_pixel = 80;
-    const int max_depth = 10;
-    cout << "Configuration: \nWidth: " << width << "\nHeight: " << height << "\n";
+    struct Path
+    {
+        PathState state;
+        HitRecord rec;
+        Pcg32 rng;
+        uint32_t kind; // Material type of the current hit
+    };
+
+    // Camera rays in pixel then sample order, traced in batches small enough
+    // for the path states to stay in cache. Paths stay in place, the queues
+    // hold their indices.
+    vector<Path> paths;
+    vector<size_t> pixels;
+    vector<uint32_t> queue, order, kindStart, next;
+    vector<uint8_t> alive;
+    vector<type_index> kinds;
+    vector<ShadowRay> shadows;
+    vector<uint32_t> shadowOwner;
+
+    auto trace_batch = [&]()
+    {
+        PROFILE_SCOPE(PhaseRayColor);
+        stats.paths += paths.size();
+
+        queue.resize(paths.size());
+        for (size_t p = 0; p < paths.size(); p++)
+            queue[p] = static_cast<uint32_t>(p);
+        alive.resize(paths.size());
+
+        while (!queue.empty())
+        {
+            // Intersect the whole queue; misses finish here
+            for (uint32_t p : queue)
+            {
+                Path &path = paths[p];
+                PROFILE_MARK(hit_start);
+                alive[p] = closest_hit(world, path.state.ray, path.state.depth, path.rec);
+                PROFILE_PIXEL_COST(pixels[p], profile_cost() - hit_start);
+                if (!alive[p])
+                {
+                    path.state.radiance += path.state.throughput * settings.background;
+                    continue;
+                }
+
+                type_index kind = typeid(*path.rec.mat_ptr);
+                path.kind = static_cast<uint32_t>(find(kinds.begin(), kinds.end(), kind) - kinds.begin());
+                if (path.kind == kinds.size())
+                    kinds.push_back(kind);
+            }
+
+            // Counting sort of the hits by material type
+            kindStart.assign(kinds.size() + 1, 0);
+            for (uint32_t p : queue)
+                if (alive[p])
+                    kindStart[paths[p].kind + 1]++;
+            for (size_t k = 1; k < kindStart.size(); k++)
+                kindStart[k] += kindStart[k - 1];
+            order.resize(kindStart.back());
+            for (uint32_t p : queue)
+                if (alive[p])
+                    order[kindStart[paths[p].kind]++] = p;
+
+            // Shade, one material type after the other
+            shadows.clear();
+            shadowOwner.clear();
+            for (uint32_t p : order)
+            {
+                Path &path = paths[p];
+                ShadowRay shadow;
+                bool has_shadow;
+                thread_sampler() = path.rng;
+                alive[p] = shade_hit(path.state, path.rec, lights, settings, stats, shadow, has_shadow);
+                path.rng = thread_sampler();
+                if (has_shadow)
+                {
+                    shadows.push_back(shadow);
+                    shadowOwner.push_back(p);
+                }
+            }
+
+            // Shadow rays
+            stats.shadow_rays += shadows.size();
+            for (size_t r = 0; r < shadows.size(); r++)
+            {
+                PROFILE_MARK(shadow_start);
+                if (!shadow_blocked(world, shadows[r]))
+                    paths[shadowOwner[r]].state.radiance += shadows[r].radiance;
+                PROFILE_PIXEL_COST(pixels[shadowOwner[r]], profile_cost() - shadow_start);
+            }
+
+            // Compact the survivors into the next queue, in material order
+            next.clear();
+            for (uint32_t p : order)
+                if (alive[p])
+                    next.push_back(p);
+            queue.swap(next);
+        }
+
+        // Accumulate in the same order as render_tile
+        for (size_t p = 0; p < paths.size(); p++)
+            acc.add(pixels[p], paths[p].state.radiance);
+        paths.clear();
+        pixels.clear();
+    };
+
+    for (int y = tile.y0; y < tile.y1; ++y)
+    {
+        int j = settings.height - 1 - y;
+        for (int i = tile.x0; i < tile.x1; ++i)
+        {
+            size_t index = static_cast<size_t>(y) * settings.width + i;
+            if (acc.converged[index])
+                continue;
+            for (uint32_t s = acc.samples[index]; s < target; ++s)
+            {
+                begin_sample(settings.seed, index, s);
+                double u = (i + random_double()) / (settings.width - 1);
+                double v = (j + random_double()) / (settings.height - 1);
+
+                Path path;
+                path.state.ray = cam.getRay(u, v);
+                path.rng = thread_sampler();
+                paths.push_back(path);
+                pixels.push_back(index);
+                if (paths.size() == static_cast<size_t>(settings.wavefront_batch))
+                    trace_batch();
+            }
+        }
+    }
+    trace_batch();
+}
+
+// Brings every pixel of `acc` up to `target` samples.
+void generate_image(const Camera &cam, const Hittable &world, const LightList &lights, const RenderSettings &settings, const uint32_t target, Accumulator &acc, PathStats &stats)
+{
+    // Generate Pixels
+    const int tile_size = 16;
+    TileScheduler scheduler(settings.width, settings.height, tile_size, settings.threads);
+    size_t tiles_remaining = scheduler.tileCount();
+    mutex progress_lock;
+
+    auto worker = [&](int id)
+    {
+        PathStats local;
+        Tile tile;
+        while (scheduler.next(id, tile))
+        {
+            if (settings.wavefront)
+                render_tile_wavefront(tile, cam, world, lights, settings, target, local, acc);
+            else if (settings.packets)
+                render_tile_packets(tile, cam, world, lights, settings, target, local, acc);
+            else
+                render_tile(tile, cam, world, lights, settings, target, local, acc);
+
+            lock_guard<mutex> guard(progress_lock);
+            std::cerr << "\rTiles remaining: " << --tiles_remaining << ' ' << std::flush;
+        }
+
+        lock_guard<mutex> guard(progress_lock);
+        stats.merge(local);
+    };
+
+    vector<thread> pool;
+    for (int id = 1; id < settings.threads; ++id)
+        pool.emplace_back(worker, id);
+    worker(0);
+    for (auto &t : pool)
+        t.join();
+}
+
+shared_ptr<Hittable> build_accel(const HittableList &scene, const string &accel)
+{
+    if (accel == "bvh")
+        return make_shared<BVH>(scene);
+    if (accel == "bvh4")
+        return make_shared<BVH4>(scene);
+    if (accel == "flat")
+        return make_shared<FlatScene>(scene);
+    return make_shared<HittableList>(scene);
+}
+
+// A fixed scene and image size of the benchmark suite
+struct BenchCase
+{
+    string name;
+    int width;
+    int height;
+    int samples_per_pixel;
+    function<HittableList()> scene;
+    Color background;
+};
+
+// Image and timings of one rendered BenchCase
+struct BenchRun
+{
+    size_t primitives = 0;
+    double scene_seconds = 0;
+    double build_seconds = 0;
+    double render_seconds = 0;
+    PathStats stats;
+    Accumulator acc;
+};
+
+BenchRun render_bench_case(const BenchCase &bench, RenderSettings settings, const string &accel)
+{
+    settings.width = bench.width;
+    settings.height = bench.height;
+    settings.aspect_ratio = static_cast<double>(bench.width) / bench.height;
+    settings.samples_per_pixel = bench.samples_per_pixel;
+    settings.background = bench.background;
+
+    BenchRun run;
+    HittableList scene;
+    shared_ptr<Hittable> world;
+    run.scene_seconds = time_seconds([&]()
+                                     { scene = bench.scene(); });
+    run.build_seconds = time_seconds([&]()
+                                     { world = build_accel(scene, accel); });
+    run.primitives = scene.objects.size();
+    LightList lights(scene);
+    Camera cam(100, settings.aspect_ratio);
+
+    run.acc = Accumulator(settings.width, settings.height);
+    run.render_seconds = time_seconds([&]()
+                                      { generate_image(cam, *world, lights, settings, settings.samples_per_pixel, run.acc, run.stats); });
+    return run;
+}
+
+// Renders one case and returns its results as a JSON object. Peak memory is
+// that of the whole process, so the suite runs each case in its own process.
+string run_bench_case(const BenchCase &bench, const RenderSettings &settings, const string &accel)
+{
+    BenchRun run = render_bench_case(bench, settings, accel);
+    const PathStats &stats = run.stats;
+
+    // FNV-1a of the resolved image, to spot output changes between runs
+    uint64_t hash = 14695981039346656037ull;
+    for (const Color &c : run.acc.resolve())
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            double value = c[i];
+            const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&value);
+            for (size_t b = 0; b < sizeof(value); b++)
+                hash = (hash ^ bytes[b]) * 1099511628211ull;
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    char json[1024];
+    snprintf(json, sizeof(json),
+             "{\"name\": \"%s\", \"width\": %d, \"height\": %d, \"spp\": %d, \"primitives\": %zu, "
+             "\"scene_s\": %.6f, \"build_s\": %.6f, \"render_s\": %.6f, "
+             "\"primary_rays\": %llu, \"secondary_rays\": %llu, \"shadow_rays\": %llu, "
+             "\"primary_rays_per_s\": %.1f, \"secondary_rays_per_s\": %.1f, "
+             "\"peak_memory_mb\": %.1f, \"image_hash\": \"%016llx\"}",
+             bench.name.c_str(), bench.width, bench.height, bench.samples_per_pixel, run.primitives,
+             run.scene_seconds, run.build_seconds, run.render_seconds,
+             static_cast<unsigned long long>(stats.paths), static_cast<unsigned long long>(stats.secondary_rays),
+             static_cast<unsigned long long>(stats.shadow_rays),
+             stats.paths / run.render_seconds, (stats.secondary_rays + stats.shadow_rays) / run.render_seconds,
+             usage.ru_maxrss / 1024.0, static_cast<unsigned long long>(hash));
+    return json;
+}
+
+// The built-in scenes, generated sphere fields and a large mesh at fixed sizes
+vector<BenchCase> bench_cases()
+{
+    const Color sky(0.7, 0.8, 1.0);
+    auto cornell_with_mesh = []()
+    {
+        // A million-triangle sphere in place of the cornell box's left sphere
+        vector<Point3> vertices;
+        vector<uint32_t> indices;
+        tessellated_sphere(1000000, vertices, indices);
+        for (Point3 &v : vertices)
+            v = 1.2 * v + Vec3(-1.5, -2.8, -3.5);
+        return cornell_box(make_shared<TriangleMesh>(std::move(vertices), std::move(indices), make_shared<Lambertian>(Color(0.8, 0.8, 0.8))));
+    };
+
+    const vector<BenchCase> cases = {
+        {"cornell", 200, 150, 16, []()
+         { return cornell_box(); }, Color(0, 0, 0)},
+        {"spheres", 200, 150, 16, first_default, Color(0, 0, 0)},
+        {"light", 200, 150, 16, light_and_sphere, Color(0, 0, 0)},
+        {"sphere_field_100k", 200, 150, 4, []()
+         { return sphere_field(100000); }, sky},
+        {"sphere_field_1m", 200, 150, 4, []()
+         { return sphere_field(1000000); }, sky},
+        {"mesh_1m", 200, 150, 16, cornell_with_mesh, Color(0, 0, 0)},
+    };
+    return cases;
+}
+
+// Deterministic benchmark suite over bench_cases(). Each case runs in a child
+// process and the results are printed as JSON, also written to `json_file` if
+// one is given. Secondary rays per second include the shadow rays.
+int run_bench_suite(const RenderSettings &settings, const string &accel, const string &json_file)
+{
+    const vector<BenchCase> cases = bench_cases();
+    string results = "{\"accel\": \"" + accel + "\", \"precision\": \"" + real_name + "\", \"threads\": " +
+                     to_string(settings.threads) + ", \"cases\": [";
+    for (size_t c = 0; c < cases.size(); c++)
+    {
+        cerr << "Running " << cases[c].name << "\n";
+        cerr.flush();
+
+        int channel[2];
+        if (pipe(channel) != 0)
+            return EXIT_FAILURE;
+        pid_t child = fork();
+        if (child == 0)
+        {
+            close(channel[0]);
+            string json = run_bench_case(cases[c], settings, accel);
+            bool sent = write(channel[1], json.data(), json.size()) == static_cast<ssize_t>(json.size());
+            _exit(sent ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        close(channel[1]);
 
-    const Color background(0, 0, 0);
+        string json;
+        char buffer[1024];
+        ssize_t received;
+        while ((received = read(channel[0], buffer, sizeof(buffer))) > 0)
+            json.append(buffer, received);
+        close(channel[0]);
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (child < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        {
+            cerr << "Benchmark case " << cases[c].name << " failed\n";
+            return EXIT_FAILURE;
+        }
+        results += (c ? ",\n  " : "\n  ") + json;
+    }
+    results += "\n]}\n";
+
+    cout << results;
+    if (!json_file.empty())
+    {
+        FILE *file = fopen(json_file.c_str(), "w");
+        if (!file || fputs(results.c_str(), file) < 0 || fclose(file) != 0)
+        {
+            cerr << "Could not write " << json_file << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
 
-    // World Setup
-    HittableList world = cornell_box();
+// Speed and image error of this build's precision. The cornell box and a
+// 100k sphere field are rendered and saved as precision_<case>_<real>.pfm,
+// then compared with the image a build of the other precision saved, if
+// there is one. A second render with another seed gives the sampling noise
+// to judge that error against.
+int run_precision_bench(const RenderSettings &settings, const string &accel)
+{
+    const string other = sizeof(real) == sizeof(float) ? "double" : "float";
+    for (const BenchCase &bench : bench_cases())
+    {
+        if (bench.name != "cornell" && bench.name != "sphere_field_100k")
+            continue;
 
-    vector<Color> pixels = generate_image(aspect_ratio, width, height, world, samples_per_pixel, max_depth, background);
-    save_file(pixels, width, height, samples_per_pixel);
+        BenchRun run = render_bench_case(bench, settings, accel);
+        RenderSettings reseeded = settings;
+        reseeded.seed++;
+        BenchRun noise = render_bench_case(bench, reseeded, accel);
 
+        vector<Color> image = run.acc.resolve();
+        uint64_t rays = run.stats.paths + run.stats.secondary_rays + run.stats.shadow_rays;
+        cout << bench.name << " " << real_name << ": " << rays / run.render_seconds / 1e6 << " Mrays/s, noise RMSE "
+             << rmse(image, noise.acc.resolve());
+
+        string file = "precision_" + bench.name + "_" + real_name + ".pfm";
+        if (!write_pfm(file, image, bench.width, bench.height, 1))
+        {
+            cerr << "Could not write " << file << "\n";
+            return EXIT_FAILURE;
+        }
+        vector<Color> expected;
+        if (read_pfm("precision_" + bench.name + "_" + other + ".pfm", expected, bench.width, bench.height))
+            cout << ", RMSE against " << other << " " << rmse(image, expected);
+        cout << endl;
+    }
+
+    HittableList field = sphere_field(100000);
+    double extent = cbrt(100000.0);
+    bench_hit(("sphere_field 100000 bvh " + string(real_name)).c_str(), BVH(field), Vec3(extent, extent, extent));
     return EXIT_SUCCESS;
 }
 
+int main(int argc, char *argv[])
+{
+    // Options
+    RenderSettings settings;
+    settings.threads = max(1u, thread::hardware_concurrency());
+    string bench;
+    string accel = "bvh";
+    string output = "raytrace.ppm";
+    string checkpoint;
+    string resume;
+    string reference;
+    string scene_name = "cornell";
+    string scene_cache;
+    string json_file;
+    string heatmap;
+    for (int a = 1; a < argc; ++a)
+    {
+        string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc)
+            settings.threads = max(1, atoi(argv[++a]));
+        else if (arg == "--seed" && a + 1 < argc)
+            settings.seed = strtoull(argv[++a], nullptr, 10);
+        else if (arg == "--max-depth" && a + 1 < argc)
+            settings.max_depth = max(1, atoi(argv[++a]));
+        else if (arg == "--rr-depth" && a + 1 < argc)
+            settings.rr_depth = max(0, atoi(argv[++a]));
+        else if (arg == "--spp" && a + 1 < argc)
+            settings.samples_per_pixel = max(1, atoi(argv[++a]));
+        else if (arg == "--pass" && a + 1 < argc)
+            settings.pass_samples = max(0, atoi(argv[++a]));
+        else if (arg == "--checkpoint" && a + 1 < argc)
+            checkpoint = argv[++a];
+        else if (arg == "--checkpoint-interval" && a + 1 < argc)
+            settings.checkpoint_interval = atof(argv[++a]);
+        else if (arg == "--resume" && a + 1 < argc)
+            resume = argv[++a];
+        else if (arg == "--noise-threshold" && a + 1 < argc)
+            settings.noise_threshold = max(0.0, atof(argv[++a]));
+        else if (arg == "--min-spp" && a + 1 < argc)
+            settings.min_samples = max(2, atoi(argv[++a]));
+        else if (arg == "--max-spp" && a + 1 < argc)
+            settings.max_samples = max(1, atoi(argv[++a]));
+        else if (arg == "--scene" && a + 1 < argc)
+            scene_name = argv[++a];
+        else if (arg == "--scene-cache" && a + 1 < argc)
+            scene_cache = argv[++a];
+        else if (arg == "--json" && a + 1 < argc)
+            json_file = argv[++a];
+        else if (arg == "--heatmap" && a + 1 < argc)
+            heatmap = argv[++a];
+        else if (arg == "--reference" && a + 1 < argc)
+            reference = argv[++a];
+        else if (arg == "--no-nee")
+            settings.nee = false;
+        else if (arg == "--wavefront")
+            settings.wavefront = true;
+        else if (arg == "--batch" && a + 1 < argc)
+            settings.wavefront_batch = max(1, atoi(argv[++a]));
+        else if (arg == "--packets")
+            settings.packets = true;
+        else if ((arg == "-o" || arg == "--output") && a + 1 < argc)
+            output = argv[++a];
+        else if (arg == "--bench" && a + 1 < argc)
+            bench = argv[++a];
+        else if (arg == "--accel" && a + 1 < argc)
+            accel = argv[++a];
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--threads N] [--seed S] [--spp N] [--max-depth N] [--rr-depth N] [--no-nee] [--packets] [--wavefront] [--batch N]"
+                 << " [--pass N] [--checkpoint FILE] [--checkpoint-interval SEC] [--resume FILE] [-o FILE.ppm|FILE.pfm]"
+                 << " [--noise-threshold E] [--min-spp N] [--max-spp N] [--reference FILE.pfm] [--heatmap FILE.ppm]"
+                 << " [--scene cornell|spheres|light|FILE] [--scene-cache FILE] [--accel bvh|bvh4|flat|list] [--bench rng|vec3|hit|bvh|build|packet|wide|flat|occluded|dense|arena|mesh|instance|suite|precision] [--json FILE]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    BVHTree::buildThreads = settings.threads;
+
+    if (bench == "rng")
+    {
+        bench_rng(settings.threads);
+        return EXIT_SUCCESS;
+    }
+    if (bench == "vec3")
+    {
+        bench_vec3();
+        return EXIT_SUCCESS;
+    }
+    if (bench == "hit")
+    {
+        HittableList scene = cornell_box();
+        bench_hit("cornell_box list", scene, Vec3(3.9, 3.9, 5.9));
+        bench_hit("cornell_box bvh", BVH(scene), Vec3(3.9, 3.9, 5.9));
+        return EXIT_SUCCESS;
+    }
+    if (bench == "bvh")
+    {
+        for (size_t count : {10000, 100000, 1000000})
+        {
+            HittableList scene = sphere_field(count);
+            double extent = cbrt(static_cast<double>(count));
+            bench_bvh(("sphere_field " + to_string(count)).c_str(), scene, Vec3(extent, extent, extent));
+        }
+        return EXIT_SUCCESS;
+    }
+    if (bench == "build")
+    {
+        // Doubling thread counts up to --threads, which defaults to every core
+        vector<int> threadCounts;
+        for (int threads = 1; threads < settings.threads; threads *= 2)
+            threadCounts.push_back(threads);
+        threadCounts.push_back(settings.threads);
+        for (size_t count : {1000000, 10000000})
+            bench_build(count, threadCounts);
+        return EXIT_SUCCESS;
+    }
+    if (bench == "packet")
+    {
+        Camera cam(100, settings.aspect_ratio);
+        HittableList scene = cornell_box();
+        bench_packet("cornell_box list", scene, cam);
+        bench_packet("cornell_box bvh", BVH(scene), cam);
+        bench_packet("sphere_field 100000 bvh", BVH(sphere_field(100000)), cam);
+        return EXIT_SUCCESS;
+    }
+    if (bench == "wide")
+    {
+        for (size_t count : {100000, 1000000})
+        {
+            HittableList scene = sphere_field(count);
+            double extent = cbrt(static_cast<double>(count));
+            bench_wide(("sphere_field " + to_string(count)).c_str(), scene, Vec3(extent, extent, extent));
+        }
+        return EXIT_SUCCESS;
+    }
+    if (bench == "flat")
+    {
+        for (size_t count : {100000, 1000000})
+        {
+            HittableList scene = sphere_field(count);
+            double extent = cbrt(static_cast<double>(count));
+            bench_flat(("sphere_field " + to_string(count)).c_str(), scene, Vec3(extent, extent, extent));
+        }
+        return EXIT_SUCCESS;
+    }
+    if (bench == "dense")
+    {
+        HittableList small = dense_spheres(1000);
+        double extent = 0.5 * cbrt(1000.0);
+        begin_sample(0, 0, 0);
+        bench_hit("dense_spheres 1000 list", small, Vec3(extent, extent, extent), 100000);
+        BVH smallBVH(small);
+        begin_sample(0, 0, 0);
+        bench_hit("dense_spheres 1000 bvh", smallBVH, Vec3(extent, extent, extent), 100000);
+
+        HittableList large = dense_spheres(100000);
+        extent = 0.5 * cbrt(100000.0);
+        BVH largeBVH(large);
+        begin_sample(0, 0, 0);
+        bench_hit("dense_spheres 100000 bvh", largeBVH, Vec3(extent, extent, extent), 200000);
+        FlatScene largeFlat(large);
+        begin_sample(0, 0, 0);
+        bench_hit("dense_spheres 100000 flat", largeFlat, Vec3(extent, extent, extent), 200000);
+        return EXIT_SUCCESS;
+    }
+    if (bench == "arena")
+    {
+        double extent = cbrt(1000000.0);
+        bench_arena("sphere_field 1000000", [](bool pooled)
+                    { return sphere_field(1000000, pooled); },
+                    Vec3(extent, extent, extent));
+        return EXIT_SUCCESS;
+    }
+    if (bench == "mesh")
+    {
+        bench_mesh(1000000, make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+        return EXIT_SUCCESS;
+    }
+    if (bench == "instance")
+    {
+        bench_instances(10000, 20000, make_shared<Lambertian>(Color(0.5, 0.5, 0.5)));
+        return EXIT_SUCCESS;
+    }
+    if (bench == "occluded")
+    {
+        HittableList cornell = cornell_box();
+        bench_occluded("cornell_box list", cornell, Vec3(3.9, 3.9, 5.9));
+        bench_occluded("cornell_box bvh", BVH(cornell), Vec3(3.9, 3.9, 5.9));
+        HittableList field = sphere_field(100000);
+        double extent = cbrt(100000.0);
+        bench_occluded("sphere_field 100000 bvh", BVH(field), Vec3(extent, extent, extent));
+        bench_occluded("sphere_field 100000 bvh4", BVH4(field), Vec3(extent, extent, extent));
+        bench_occluded("sphere_field 100000 flat", FlatScene(field), Vec3(extent, extent, extent));
+        return EXIT_SUCCESS;
+    }
+    if (accel != "bvh" && accel != "bvh4" && accel != "flat" && accel != "list")
+    {
+        cerr << "Unknown acceleration structure: " << accel << "\n";
+        return EXIT_FAILURE;
+    }
+    if (bench == "suite")
+        return run_bench_suite(settings, accel, json_file);
+    if (bench == "precision")
+        return run_precision_bench(settings, accel);
+
+    // Screen
+    settings.height = static_cast<int>(settings.width / settings.aspect_ratio);
+    cout << "Configuration: \nWidth: " << settings.width << "\nHeight: " << settings.height
+         << "\nThreads: " << settings.threads << "\n";
+
+    // World Setup, from a built-in scene or a scene file. A scene file with a
+    // cache is traced as a FlatScene mapped from the cache, which is written
+    // on the first run and rewritten whenever the scene file changes.
+    SceneDescription description;
+    shared_ptr<FlatScene> cached;
+    bool builtin = scene_name == "cornell" || scene_name == "spheres" || scene_name == "light";
+    if (builtin && !scene_cache.empty())
+    {
+        cerr << "--scene-cache needs a scene file\n";
+        return EXIT_FAILURE;
+    }
+    if (scene_name == "cornell")
+        description.world = cornell_box();
+    else if (scene_name == "spheres")
+        description.world = first_default();
+    else if (scene_name == "light")
+        description.world = light_and_sphere();
+    else
+    {
+        string error;
+        auto load_start = chrono::steady_clock::now();
+        if (!scene_cache.empty() && SceneCache::load(scene_cache, scene_name, cached, description, error))
+        {
+            chrono::duration<double> load_time = chrono::steady_clock::now() - load_start;
+            cout << "Mapped " << scene_cache << ": " << cached->sphereCount() << " spheres, " << cached->rectCount()
+                 << " rects in " << load_time.count() << " s\n";
+        }
+        else
+        {
+            if (!scene_cache.empty())
+                cerr << "Rebuilding scene cache (" << error << ")\n";
+            if (!load_scene(scene_name, description, error))
+            {
+                cerr << "Cannot load scene " << scene_name << ": " << error << "\n";
+                return EXIT_FAILURE;
+            }
+            chrono::duration<double> load_time = chrono::steady_clock::now() - load_start;
+            cout << "Loaded " << scene_name << ": " << description.world.objects.size() << " primitives, "
+                 << description.materials.size() << " materials, " << description.textureCount << " textures in "
+                 << load_time.count() << " s, " << description.world.arena->bytesUsed() / 1e6 << " MB in the scene arena\n";
+
+            if (!scene_cache.empty())
+            {
+                cached = make_shared<FlatScene>(description.world);
+                if (!SceneCache::save(scene_cache, scene_name, *cached, description))
+                    cerr << "Could not write scene cache " << scene_cache << "\n";
+            }
+        }
+        if (description.hasBackground)
+            settings.background = description.background;
+    }
+    // A mapped scene has no Hittable list, only its lights are rebuilt as one
+    HittableList emitters;
+    if (cached)
+        emitters = cached->emitters();
+    const HittableList &scene = cached ? emitters : description.world;
+    const CameraSettings &view = description.camera;
+    Camera cam(view.lookfrom, view.lookat, view.vup, view.vfov, settings.aspect_ratio);
+
+    shared_ptr<Hittable> world = cached ? cached : build_accel(scene, accel);
+
+    LightList lights(scene);
+    cout << "Lights: " << lights.size() << "\n";
+
+    // Accumulation buffer, optionally restored from a checkpoint
+    Accumulator acc(settings.width, settings.height);
+    if (!resume.empty())
+    {
+        if (!acc.load(resume, settings.seed) || acc.width != settings.width || acc.height != settings.height)
+        {
+            cerr << "Cannot resume from " << resume << "\n";
+            return EXIT_FAILURE;
+        }
+        cerr << "Resuming from " << resume << " at " << acc.minSamples() << " samples per pixel\n";
+    }
+    if (checkpoint.empty())
+        checkpoint = output + ".ckpt";
+
+#ifdef RT_PROFILE
+    if (!heatmap.empty())
+        profile_heatmap().assign(acc.size(), 0.0);
+#else
+    if (!heatmap.empty())
+    {
+        cerr << "--heatmap needs a build with -DRT_PROFILE\n";
+        return EXIT_FAILURE;
+    }
+#endif
+
+    // Render in passes, checkpointing between them. Uniform sampling brings
+    // every pixel to samples_per_pixel. Adaptive sampling treats
+    // samples_per_pixel as the average budget: after each pass converged
+    // pixels stop, and the rest continue up to max_samples. A pass is cut
+    // short to what is left of the budget, so it is never exceeded.
+    const bool adaptive = settings.noise_threshold > 0;
+    const uint64_t budget = static_cast<uint64_t>(settings.samples_per_pixel) * acc.size();
+    const uint32_t total = adaptive ? (settings.max_samples > 0 ? settings.max_samples : 8 * settings.samples_per_pixel)
+                                    : settings.samples_per_pixel;
+    const uint32_t pass = settings.pass_samples > 0 ? settings.pass_samples : (adaptive ? 8 : total);
+    const bool progressive = settings.pass_samples > 0;
+    PathStats stats;
+    auto start = chrono::steady_clock::now();
+    auto last_checkpoint = start;
+    size_t active = acc.size();
+    for (uint32_t target = acc.minSamples(); target < total && active > 0;)
+    {
+        uint32_t next = min(total, max(target + pass, adaptive ? static_cast<uint32_t>(settings.min_samples) : 0u));
+        if (adaptive)
+        {
+            // Highest target up to next whose samples fit in the budget
+            uint64_t left = budget - min(budget, acc.totalSamples());
+            uint32_t low = target;
+            while (low < next)
+            {
+                uint32_t mid = low + (next - low + 1) / 2;
+                if (acc.samplesToReach(mid) <= left)
+                    low = mid;
+                else
+                    next = mid - 1;
+            }
+            if (next == target)
+                break;
+        }
+        target = next;
+        generate_image(cam, *world, lights, settings, target, acc, stats);
+
+        if (adaptive)
+        {
+            active = acc.updateConvergence(settings.noise_threshold, settings.min_samples);
+            // Stop once the budget cannot give every active pixel one more sample
+            if (budget - min(budget, acc.totalSamples()) < active)
+                active = 0;
+            cerr << "\nPass complete: " << target << " samples, " << active << " pixels still sampling\n";
+        }
+        else if (progressive)
+            cerr << "\nPass complete: " << target << " samples per pixel\n";
+
+        if (!progressive)
+            continue;
+        chrono::duration<double> since = chrono::steady_clock::now() - last_checkpoint;
+        if (since.count() >= settings.checkpoint_interval || target == total || active == 0)
+        {
+            PROFILE_SCOPE(PhaseOutput);
+            if (!acc.save(checkpoint, settings.seed))
+                cerr << "Could not write checkpoint " << checkpoint << "\n";
+            save_file(output, acc.resolve(), settings.width, settings.height, 1);
+            last_checkpoint = chrono::steady_clock::now();
+        }
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    cerr << "\nDone in " << elapsed.count() << " s.\n";
+    if (adaptive)
+    {
+        uint64_t used = acc.totalSamples();
+        cerr << "Samples: " << used << " of " << budget << " (" << 100.0 * (1.0 - static_cast<double>(used) / budget)
+             << "% saved), average " << static_cast<double>(used) / acc.size() << " per pixel\n";
+    }
+    if (!reference.empty())
+    {
+        vector<Color> expected;
+        if (!read_pfm(reference, expected, settings.width, settings.height))
+        {
+            cerr << "Cannot read reference " << reference << "\n";
+            return EXIT_FAILURE;
+        }
+        cerr << "RMSE against " << reference << ": " << rmse(acc.resolve(), expected) << "\n";
+    }
+    if (stats.paths > 0)
+    {
+        cerr << "Average bounces per path: " << static_cast<double>(stats.bounces) / stats.paths << "\n";
+        if (stats.shadow_rays > 0)
+            cerr << "Shadow rays per path: " << static_cast<double>(stats.shadow_rays) / stats.paths << "\n";
+        if (settings.rr_depth > 0)
+        {
+            cerr << "Paths ended by Russian roulette: " << stats.roulette_kills
+                 << " (" << 100.0 * stats.roulette_kills / stats.paths << "%)\n"
+                 << "Average bounces saved per path (upper bound): " << static_cast<double>(stats.roulette_skipped) / stats.paths << "\n";
+        }
+    }
+
+    bool saved = save_file(output, acc.resolve(), settings.width, settings.height, 1);
+
+#ifdef RT_PROFILE
+    if (!heatmap.empty())
+    {
+        double scale_max;
+        if (write_heatmap(heatmap, settings.width, settings.height, acc.samples, scale_max))
+            cerr << "Saved heatmap " << heatmap << ", white at " << scale_max << " nodes and primitive tests per sample\n";
+        else
+            cerr << "Could not write " << heatmap << "\n";
+    }
+    print_profile(cerr);
+#endif
+
+    return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 //Different Scenes:
 HittableList first_default()
 {
@@ -162,7 +1231,8 @@ HittableList light_and_sphere()
     return world;
 }
 
-HittableList cornell_box()
+// The left sphere is replaced by `leftObject` when one is given
+HittableList cornell_box(shared_ptr<Hittable> leftObject)
 {
     HittableList world;
 
@@ -192,14 +1262,63 @@ HittableList cornell_box()
     world.add(make_shared<XYRect>(-x, x, -y, y, z, normal));  // Back - Enclose light
 
     // Light source
-    world.add(make_shared<XZRect>(-2, 2, -z + 1, z - 1, y - 1e-8, light));
+    world.add(make_shared<XZRect>(-2, 2, -z + 1, z - 1, y - surface_offset, light));
 
     // Other objects
 
-    world.add(make_shared<Sphere>(Point3(-1.5, -y + 1.2, -3.5), 1.2, obj1Mat)); //Left
+    if (leftObject)
+        world.add(leftObject);
+    else
+        world.add(make_shared<Sphere>(Point3(-1.5, -y + 1.2, -3.5), 1.2, obj1Mat)); //Left
     world.add(make_shared<Sphere>(Point3(1, -2.1, -3), 0.7, obj2Mat));
 
     world.add(make_shared<XYRect>(-x, x, -y, y, -2, glass)); // Glass wall
 
     return world;
-}
\ No newline at end of file
+}
+
+// Random spheres filling a cube of side 2 * cbrt(count), for BVH benchmarks.
+// Allocated from a SceneArena unless `pooled` is false.
+HittableList sphere_field(size_t count, bool pooled)
+{
+    HittableList world;
+    if (pooled)
+        world.arena = make_shared<SceneArena>();
+
+    shared_ptr<Lambertian> materials[] = {
+        world.make<Lambertian>(world.make<SolidColor>(Color(0.8, 0.3, 0.3))),
+        world.make<Lambertian>(world.make<SolidColor>(Color(0.3, 0.8, 0.3))),
+        world.make<Lambertian>(world.make<SolidColor>(Color(0.3, 0.3, 0.8)))};
+
+    // Fixed stream, so a given count always yields the same field
+    begin_sample(0, count, 0);
+
+    double extent = cbrt(static_cast<double>(count));
+    world.objects.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Point3 center = Vec3::random(-extent, extent);
+        world.add(world.make<Sphere>(center, random_double(0.1, 0.4), materials[i % 3]));
+    }
+
+    return world;
+}
+
+// Heavily overlapping spheres in a cube of side cbrt(count), where rays pass
+// through many candidate hits before the closest one
+HittableList dense_spheres(size_t count)
+{
+    HittableList world;
+    world.arena = make_shared<SceneArena>();
+
+    shared_ptr<Lambertian> material = world.make<Lambertian>(world.make<SolidColor>(Color(0.5, 0.5, 0.5)));
+
+    begin_sample(0, count, 1);
+
+    double extent = 0.5 * cbrt(static_cast<double>(count));
+    world.objects.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        world.add(world.make<Sphere>(Vec3::random(-extent, extent), random_double(0.5, 1.0), material));
+
+    return world;
+}